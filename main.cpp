@@ -1,17 +1,87 @@
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include <array>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <climits>
 #include <condition_variable>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <latch>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string_view>
 #include <thread>
 #include <vector>
 
 using namespace std;
 
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static void futexWait(atomic<uint32_t> &word, uint32_t expected) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+static void futexWait(atomic<uint32_t> &word, uint32_t expected, chrono::nanoseconds timeout) {
+  if (timeout <= chrono::nanoseconds::zero()) {
+    return;
+  }
+  const auto seconds = chrono::duration_cast<chrono::seconds>(timeout);
+  const timespec relative{static_cast<time_t>(seconds.count()), static_cast<long>((timeout - seconds).count())};
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &relative, nullptr, 0);
+}
+static void futexWake(atomic<uint32_t> &word, int count) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+// Steady clock time points as plain nanosecond counts, so they fit in atomics.
+static int64_t nowNanoseconds() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+static void sleepUntil(int64_t nanoseconds) {
+  this_thread::sleep_until(chrono::steady_clock::time_point(chrono::nanoseconds(nanoseconds)));
+}
+
+// Test-and-set spinlock for queue bookkeeping that is only held for a few
+// instructions and never while waiting.
+class SpinGuard {
+public:
+  void lock() {
+    while (flag_.test_and_set(memory_order_acquire)) {
+      cpuRelax();
+    }
+  }
+  void unlock() {
+    flag_.clear(memory_order_release);
+  }
+
+private:
+  atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
 class PriorityMutex {
 public:
   virtual void lockLowPriority() = 0;
@@ -19,6 +89,83 @@ public:
 
   virtual void lockHighPriority() = 0;
   virtual void unlockHighPriority() = 0;
+
+  // Generalization to any number of priority levels, numbered from 0 (the
+  // lowest) to priorityLevels() - 1. Implementations with only the two levels
+  // above map level 0 to the low priority side and every other level to the
+  // high priority side.
+  virtual int priorityLevels() const {
+    return 2;
+  }
+  virtual void lock(int priority) {
+    if (priority == 0) {
+      lockLowPriority();
+    } else {
+      lockHighPriority();
+    }
+  }
+  virtual void unlock(int priority) {
+    if (priority == 0) {
+      unlockLowPriority();
+    } else {
+      unlockHighPriority();
+    }
+  }
+
+  // High priority acquisition that should complete by `deadline`.
+  // Implementations without a notion of deadlines treat it as any other high
+  // priority acquisition.
+  virtual void lockWithDeadline([[maybe_unused]] chrono::steady_clock::time_point deadline) {
+    lockHighPriority();
+  }
+  virtual void unlockWithDeadline() {
+    unlockHighPriority();
+  }
+
+  // Runs `fn` as a high priority reader of the resource and returns how many
+  // attempts at the read were abandoned because a writer intervened.
+  // Implementations may run `fn` concurrently with a writer, so it must
+  // tolerate torn data and must not publish anything it read until this
+  // returns. By default the read simply holds the lock and never retries.
+  virtual int readHighPriority(const function<void()> &fn) {
+    lockHighPriority();
+    fn();
+    unlockHighPriority();
+    return 0;
+  }
+
+  // Runs `fn` as a high priority access to the resource and returns once it
+  // has run. Implementations may run `fn` on whichever thread holds the
+  // resource rather than on the caller. By default the caller takes the high
+  // priority lock and runs it itself.
+  virtual void delegateHighPriority(const function<void()> &fn) {
+    lockHighPriority();
+    fn();
+    unlockHighPriority();
+  }
+
+  // Checkpoints for a low priority holder that can split its work into chunks.
+  // Between chunks it asks shouldYield() whether a high priority thread is
+  // waiting and, if so, calls yieldToHighPriority(), which returns with the
+  // lock held again. Implementations that cannot tell whether a high priority
+  // thread is waiting never ask the holder to yield.
+  virtual bool shouldYield() {
+    return false;
+  }
+  virtual void yieldToHighPriority() {
+    unlockLowPriority();
+    lockLowPriority();
+  }
+
+  // Called by the low priority thread once it stops locking, for
+  // implementations that keep the lock between its holds.
+  virtual void endLowPriorityLease() {}
+
+  // Brackets the part of a low priority hold that modifies the resource. The
+  // rest of the hold only reads it, so implementations with an optimistic
+  // readHighPriority() only need to invalidate readers inside this section.
+  virtual void beginLowPriorityWrite() {}
+  virtual void endLowPriorityWrite() {}
 };
 
 class BasicPriorityMutex : public PriorityMutex {
@@ -40,6 +187,40 @@ private:
   mutex mutex_;
 };
 
+// A single pthread mutex with the priority inheritance protocol: while a
+// thread with a higher scheduling priority waits, the holder runs at that
+// priority. Only meaningful when the test threads have different scheduling
+// priorities.
+class PthreadInheritPriorityMutex : public PriorityMutex {
+public:
+  PthreadInheritPriorityMutex() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&mutex_, &attr);
+    pthread_mutexattr_destroy(&attr);
+  }
+  ~PthreadInheritPriorityMutex() {
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  void lockLowPriority() override {
+    pthread_mutex_lock(&mutex_);
+  }
+  void unlockLowPriority() override {
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  void lockHighPriority() override {
+    pthread_mutex_lock(&mutex_);
+  }
+  void unlockHighPriority() override {
+    pthread_mutex_unlock(&mutex_);
+  }
+private:
+  pthread_mutex_t mutex_;
+};
+
 class TwoMutexPriorityMutex : public PriorityMutex {
 public:
   void lockLowPriority() override {
@@ -77,6 +258,9 @@ public:
     lowPriorityLock_.unlock();
     cv_.notify_all();
   }
+  bool shouldYield() override {
+    return waiting_;
+  }
 
   void lockHighPriority() override {
     waiting_ = true;
@@ -138,129 +322,2549 @@ private:
   unique_lock<mutex> highPriorityLock_{dataMutex_, defer_lock};
 };
 
-// Two types of workers:
-//  1. "Trainer": Tight loop, needs resource for entire body.
-//  2. "Server": Only needs resource for small fraction of body.
-class ContentionTest {
+// MutexAndTwoBoolPriorityMutex without the mutex and condition_variable: the
+// two booleans are packed into `state_` and both sides block with C++20
+// atomic wait/notify on that one word. Besides `dataHeld`, the word has a bit
+// for a blocked low priority thread and counts waiting high priority threads
+// in the remaining bits, so unlock only notifies when someone is blocked.
+class AtomicWaitPriorityMutex : public PriorityMutex {
 public:
-  ContentionTest(PriorityMutex *priorityMutex,
-                 chrono::microseconds lowPrioWorkTime,
-                 chrono::microseconds highPrioWorkTime,
-                 chrono::microseconds highPrioSleepTime) :
-                    priorityMutex_(priorityMutex),
-                    lowPrioWorkTime_(lowPrioWorkTime),
-                    highPrioWorkTime_(highPrioWorkTime),
-                    highPrioSleepTime_(highPrioSleepTime) {}
+  void lockLowPriority() override {
+    uint32_t s = state_.load();
+    while (true) {
+      if ((s & ~kLowPriorityWaiting) == 0) {
+        // Keep the waiting bit; another low priority thread may still be
+        // blocked.
+        if (state_.compare_exchange_weak(s, s | kDataHeld)) {
+          return;
+        }
+        continue;
+      }
+      if (!(s & kLowPriorityWaiting) && !state_.compare_exchange_weak(s, s | kLowPriorityWaiting)) {
+        continue;
+      }
+      state_.wait(s | kLowPriorityWaiting);
+      s = state_.load();
+    }
+  }
+  void unlockLowPriority() override {
+    release();
+  }
+  bool shouldYield() override {
+    return state_.load(memory_order_relaxed) >= kHighPriorityWaiting;
+  }
 
-  pair<double, double> run() {
-    thread thr1(std::bind(&ContentionTest::lowPriorityThreadFunction, this));
-    thread thr2(std::bind(&ContentionTest::highPriorityThreadFunction, this));
-    this_thread::sleep_for(kTestDurationSeconds);
-    shouldRun_ = false;
-    thr1.join();
-    thr2.join();
-    return {lowPriorityThreadWorkTime_, highPriorityThreadLatencyTime_};
+  void lockHighPriority() override {
+    uint32_t s = state_.fetch_add(kHighPriorityWaiting) + kHighPriorityWaiting;
+    while (true) {
+      if (s & kDataHeld) {
+        state_.wait(s);
+        s = state_.load();
+        continue;
+      }
+      if (state_.compare_exchange_weak(s, (s | kDataHeld) - kHighPriorityWaiting)) {
+        return;
+      }
+    }
+  }
+  void unlockHighPriority() override {
+    release();
   }
 
 private:
-  static constexpr chrono::seconds kTestDurationSeconds{120};
-  PriorityMutex *priorityMutex_;
-  const chrono::microseconds lowPrioWorkTime_;
-  const chrono::microseconds highPrioWorkTime_;
-  const chrono::microseconds highPrioSleepTime_;
-  mutex workMutex_;
-  atomic<bool> shouldRun_{true};
-  double lowPriorityThreadWorkTime_;
-  double highPriorityThreadLatencyTime_;
+  static constexpr uint32_t kDataHeld = 1;
+  static constexpr uint32_t kLowPriorityWaiting = 2;
+  static constexpr uint32_t kHighPriorityWaiting = 4;
+  atomic<uint32_t> state_{0};
 
-  void lowPriorityThreadFunction() {
-    int64_t workTime = 0;
+  void release() {
+    uint32_t s = state_.load(memory_order_relaxed);
+    uint32_t desired;
+    do {
+      // A blocked low priority thread is woken with everyone else, so it no
+      // longer needs its bit unless it blocks again.
+      desired = s & ~(kDataHeld | kLowPriorityWaiting);
+    } while (!state_.compare_exchange_weak(s, desired));
+    if (s != kDataHeld) {
+      // Both sides wait on the same word, so wake everyone rather than risk
+      // waking only a low priority thread that has to keep waiting.
+      state_.notify_all();
+    }
+  }
+};
 
-    while (shouldRun_) {
-      priorityMutex_->lockLowPriority();
-      
-      // Do work...
-      auto startTime = chrono::high_resolution_clock::now();
-      this_thread::sleep_for(lowPrioWorkTime_);
-      workTime += chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - startTime).count();
-      
-      priorityMutex_->unlockLowPriority();
+// Talks to futex(2) directly instead of going through a condition_variable.
+// `state_` is the ownership word and is what the high priority thread parks on.
+// `highPriorityPending_` counts high priority threads that want the lock; the
+// low priority thread parks on it while it is non-zero.
+//
+// With `directHandoff`, unlockLowPriority() never releases the lock into the
+// open while a high priority thread is pending. It marks the lock as handed off
+// instead, which only the high priority side may claim, so the low priority
+// thread's immediate re-lock cannot win the race against the waking thread.
+class FutexPriorityMutex : public PriorityMutex {
+public:
+  explicit FutexPriorityMutex(bool directHandoff = false) : directHandoff_(directHandoff) {}
+
+  void lockLowPriority() override {
+    while (true) {
+      const uint32_t pending = highPriorityPending_.load();
+      if (pending != 0) {
+        futexWait(highPriorityPending_, pending);
+        continue;
+      }
+      if (tryAcquire()) {
+        return;
+      }
+      // Never overwrite kHandedOff here; that state belongs to the high
+      // priority side.
+      uint32_t c = state_.load();
+      if (c == kFree) {
+        continue;
+      }
+      if (c == kHeld && !state_.compare_exchange_strong(c, kHeldWithWaiters)) {
+        continue;
+      }
+      futexWait(state_, c == kHeld ? kHeldWithWaiters : c);
     }
-    lowPriorityThreadWorkTime_ = workTime;
+  }
+  void unlockLowPriority() override {
+    if (directHandoff_ && highPriorityPending_.load() != 0) {
+      // A pending high priority thread cannot stop being pending without
+      // taking the lock, so someone is guaranteed to claim it.
+      state_.store(kHandedOff);
+      futexWake(state_, INT_MAX);
+      return;
+    }
+    release();
+  }
+  bool shouldYield() override {
+    return highPriorityPending_.load(memory_order_relaxed) != 0;
   }
 
-  void highPriorityThreadFunction() {
-    int64_t latencyTime = 0;
-    while (shouldRun_) {
-      // Sleep for a bit.
-      this_thread::sleep_for(highPrioSleepTime_);
+  void lockHighPriority() override {
+    highPriorityPending_.fetch_add(1);
+    if (!tryAcquireHighPriority()) {
+      acquireContended();
+    }
+    endHighPriorityPending();
+  }
+  void unlockHighPriority() override {
+    release();
+  }
 
-      auto startTime = chrono::high_resolution_clock::now();
-      priorityMutex_->lockHighPriority();
-      latencyTime += chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - startTime).count();
-      
-      // Do work...
-      this_thread::sleep_for(highPrioWorkTime_);
+protected:
+  static constexpr uint32_t kFree = 0;
+  static constexpr uint32_t kHeld = 1;
+  static constexpr uint32_t kHeldWithWaiters = 2;
+  static constexpr uint32_t kHandedOff = 3;
+  const bool directHandoff_;
+  atomic<uint32_t> state_{kFree};
+  atomic<uint32_t> highPriorityPending_{0};
 
-      priorityMutex_->unlockHighPriority();
+  bool tryAcquire() {
+    uint32_t c = kFree;
+    return state_.load(memory_order_relaxed) == kFree && state_.compare_exchange_strong(c, kHeld);
+  }
+  bool tryAcquireHighPriority() {
+    uint32_t c = kHandedOff;
+    return tryAcquire() || (state_.load(memory_order_relaxed) == kHandedOff && state_.compare_exchange_strong(c, kHeldWithWaiters));
+  }
+  // Parks on `state_` until the lock is acquired. High priority side only.
+  void acquireContended() {
+    uint32_t c;
+    while ((c = state_.exchange(kHeldWithWaiters)) != kFree && c != kHandedOff) {
+      futexWait(state_, kHeldWithWaiters);
+    }
+  }
+  void endHighPriorityPending() {
+    if (highPriorityPending_.fetch_sub(1) == 1) {
+      futexWake(highPriorityPending_, INT_MAX);
+    }
+  }
+
+  void release() {
+    if (state_.exchange(kFree) == kHeldWithWaiters) {
+      // A low priority waiter woken alone would defer to the high priority
+      // thread and go back to sleep without passing the wakeup on, so wake
+      // everyone while a high priority thread is pending.
+      futexWake(state_, highPriorityPending_.load() != 0 ? INT_MAX : 1);
     }
-    highPriorityThreadLatencyTime_ = latencyTime;
   }
 };
 
-int main() {
-  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
-    {new BasicPriorityMutex(), "BasicPriorityMutex"},
-    {new TwoMutexPriorityMutex(), "TwoMutexPriorityMutex"},
-    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
-    {new MutexAndTwoBoolPriorityMutex(), "MutexAndTwoBoolPriorityMutex"}
-  };
-  vector<chrono::microseconds> microseconds = {
-    chrono::microseconds{1},
-    chrono::microseconds{10},
-    chrono::microseconds{100},
-    chrono::microseconds{1'000},
-    chrono::microseconds{10'000},
-    chrono::microseconds{100'000},
-    chrono::microseconds{1'000'000}
-  };
-  printf("  Low Work,  High Work, High Sleep\n");
-  map<string, int> winnerCountForLow;
-  map<string, int> winnerCountForHigh;
-  for (auto lowPrioWorkTime : microseconds) {
-    for (auto highPrioWorkTime : microseconds) {
-      for (auto highPrioSleepTime : microseconds) {
-        string bestLowName;
-        string bestHighName;
-        string bestBothName;
-        double bestLow = 0.0;
-        double bestHigh = numeric_limits<double>::max();
-        printf("%10d, %10d, %10d\n", lowPrioWorkTime.count(), highPrioWorkTime.count(), highPrioSleepTime.count());
-        for (auto &priorityMutexAndName : priorityMutexes) {
-          ContentionTest test(priorityMutexAndName.first, lowPrioWorkTime, highPrioWorkTime, highPrioSleepTime);
-          const auto [lowPriorityWorkTime, highPriorityLatencyTime] = test.run();
-          printf("%31s Low Priority: %12.0f, High Priority: %12.0f\n", priorityMutexAndName.second.data(), lowPriorityWorkTime, highPriorityLatencyTime);
-          if (lowPriorityWorkTime > bestLow) {
-            bestLow = lowPriorityWorkTime;
-            bestLowName = priorityMutexAndName.second;
-          }
-          if (highPriorityLatencyTime < bestHigh) {
-            bestHigh = highPriorityLatencyTime;
-            bestHighName = priorityMutexAndName.second;
-          }
+// FutexPriorityMutex that spins for up to a fixed budget before parking. The
+// budgets are separate per side: the high priority side can afford to burn CPU
+// for lower latency, while the low priority side should park almost at once.
+// While the high priority thread spins it is already counted as pending, so the
+// low priority thread defers to it exactly as it would to a parked one.
+class SpinThenParkPriorityMutex : public FutexPriorityMutex {
+public:
+  SpinThenParkPriorityMutex(chrono::nanoseconds highPrioritySpinBudget,
+                            chrono::nanoseconds lowPrioritySpinBudget) :
+                               highPrioritySpinBudget_(highPrioritySpinBudget),
+                               lowPrioritySpinBudget_(lowPrioritySpinBudget) {}
+
+  void lockLowPriority() override {
+    const bool acquired = spinFor(lowPrioritySpinBudget_, [this]() -> bool {
+      return highPriorityPending_.load(memory_order_relaxed) == 0 && tryAcquire();
+    });
+    if (!acquired) {
+      FutexPriorityMutex::lockLowPriority();
+    }
+  }
+
+  void lockHighPriority() override {
+    highPriorityPending_.fetch_add(1);
+    const bool acquired = spinFor(highPrioritySpinBudget_, [this]() -> bool {
+      return tryAcquireHighPriority();
+    });
+    if (!acquired) {
+      acquireContended();
+    }
+    endHighPriorityPending();
+  }
+
+private:
+  const chrono::nanoseconds highPrioritySpinBudget_;
+  const chrono::nanoseconds lowPrioritySpinBudget_;
+
+  template<typename TryAcquire>
+  static bool spinFor(chrono::nanoseconds budget, TryAcquire tryAcquire) {
+    if (budget <= chrono::nanoseconds::zero()) {
+      return false;
+    }
+    const auto deadline = chrono::steady_clock::now() + budget;
+    do {
+      if (tryAcquire()) {
+        return true;
+      }
+      cpuRelax();
+    } while (chrono::steady_clock::now() < deadline);
+    return false;
+  }
+};
+
+// FutexPriorityMutex in which the low priority thread takes a lease instead of
+// a single hold. While the lease lasts, unlockLowPriority() keeps the lock and
+// the next lockLowPriority() returns at once, so the low priority thread does
+// no atomic read-modify-write between holds; it only reads the pending
+// counter. The lease ends after `leaseIterations` holds, after
+// `leaseDuration`, or at the first unlock or lock that sees a high priority
+// thread pending, whichever comes first. A high priority thread therefore
+// waits for at most the rest of one low priority hold. Supports a single low
+// priority thread, which must call endLowPriorityLease() when it stops.
+class LeasePriorityMutex : public FutexPriorityMutex {
+public:
+  LeasePriorityMutex(chrono::nanoseconds leaseDuration, int leaseIterations) :
+                        leaseDuration_(leaseDuration),
+                        leaseIterations_(leaseIterations) {}
+
+  void lockLowPriority() override {
+    if (leaseHeld_) {
+      if (highPriorityPending_.load(memory_order_relaxed) == 0) {
+        return;
+      }
+      endLowPriorityLease();
+    }
+    FutexPriorityMutex::lockLowPriority();
+    leaseHeld_ = true;
+    leaseIterationsLeft_ = leaseIterations_;
+    leaseDeadline_ = chrono::steady_clock::now() + leaseDuration_;
+  }
+  void unlockLowPriority() override {
+    if (--leaseIterationsLeft_ > 0 &&
+        highPriorityPending_.load(memory_order_relaxed) == 0 &&
+        chrono::steady_clock::now() < leaseDeadline_) {
+      return;
+    }
+    endLowPriorityLease();
+  }
+
+  void endLowPriorityLease() override {
+    if (leaseHeld_) {
+      leaseHeld_ = false;
+      FutexPriorityMutex::unlockLowPriority();
+    }
+  }
+
+private:
+  const chrono::nanoseconds leaseDuration_;
+  const int leaseIterations_;
+  // Only touched by the low priority thread.
+  bool leaseHeld_{false};
+  int leaseIterationsLeft_{0};
+  chrono::steady_clock::time_point leaseDeadline_;
+};
+
+// FutexPriorityMutex with recurring time windows reserved for the high
+// priority thread, which is assumed to come back `windowPeriod` after each
+// unlock. Every unlockHighPriority() reserves the window of `windowWidth` that
+// starts one period later, so the windows follow the high priority thread's
+// actual cycle instead of drifting away from a fixed anchor, and a window left
+// over from an earlier test has long expired by the next one. The low priority
+// thread only starts a hold if it is predicted to end before the next window,
+// and otherwise waits until the window is over or the high priority thread has
+// been and gone. The prediction is a moving average of the low priority
+// thread's observed hold times. A hold that could never fit between windows is
+// started as soon as a window ends.
+class TdmaPriorityMutex : public FutexPriorityMutex {
+public:
+  TdmaPriorityMutex(chrono::nanoseconds windowPeriod, chrono::nanoseconds windowWidth) :
+                       windowPeriod_(windowPeriod.count()),
+                       windowWidth_(windowWidth.count()) {}
+
+  void lockLowPriority() override {
+    while (true) {
+      const uint32_t windows = windows_.load();
+      const int64_t windowStart = windowStart_.load(memory_order_relaxed);
+      const int64_t windowEnd = windowStart + windowWidth_;
+      const int64_t now = nowNanoseconds();
+      const bool fits = now + predictedHold_ <= windowStart || predictedHold_ > windowPeriod_ - windowWidth_;
+      if (windowStart != 0 && now < windowEnd && (now >= windowStart || !fits)) {
+        lowPriorityWaiting_.store(true);
+        futexWait(windows_, windows, chrono::nanoseconds(windowEnd - now));
+        lowPriorityWaiting_.store(false);
+        continue;
+      }
+      FutexPriorityMutex::lockLowPriority();
+      holdStart_ = nowNanoseconds();
+      return;
+    }
+  }
+  void unlockLowPriority() override {
+    const int64_t hold = nowNanoseconds() - holdStart_;
+    predictedHold_ = predictedHold_ == 0 ? hold : (7 * predictedHold_ + hold) / 8;
+    FutexPriorityMutex::unlockLowPriority();
+  }
+
+  void unlockHighPriority() override {
+    windowStart_.store(nowNanoseconds() + windowPeriod_, memory_order_relaxed);
+    windows_.fetch_add(1);
+    if (lowPriorityWaiting_.load()) {
+      futexWake(windows_, INT_MAX);
+    }
+    FutexPriorityMutex::unlockHighPriority();
+  }
+
+private:
+  const int64_t windowPeriod_;
+  const int64_t windowWidth_;
+  atomic<int64_t> windowStart_{0};
+  // Bumped whenever a new window is reserved, to wake a waiting low priority
+  // thread early.
+  atomic<uint32_t> windows_{0};
+  atomic<bool> lowPriorityWaiting_{false};
+  // Only touched by the low priority thread.
+  int64_t holdStart_{0};
+  int64_t predictedHold_{0};
+};
+
+// FutexPriorityMutex that learns when the high priority thread will next
+// arrive. Every lockHighPriority() updates a moving average of the time between
+// arrivals. The low priority thread defers a hold that is predicted to overlap
+// the next arrival, and is woken as soon as the high priority thread actually
+// arrives, or once it is a quarter period late and the prediction is assumed
+// stale. Unlike MutexAndAtomicBoolPriorityMutex, the low priority thread only
+// stands aside just before an arrival, not for as long as the high priority
+// thread waits. Assumes a single periodic high priority thread.
+class PredictivePriorityMutex : public FutexPriorityMutex {
+public:
+  void lockLowPriority() override {
+    lowPriorityDeferring_.store(true);
+    while (true) {
+      const uint32_t arrivals = arrivals_.load();
+      const int64_t period = period_.load(memory_order_relaxed);
+      const int64_t nextArrival = lastArrival_.load(memory_order_relaxed) + period;
+      const int64_t now = nowNanoseconds();
+      if (period == 0 || predictedHold_ >= period ||
+          now + predictedHold_ <= nextArrival || now >= nextArrival + period / 4) {
+        break;
+      }
+      futexWait(arrivals_, arrivals, chrono::nanoseconds(nextArrival + period / 4 - now));
+    }
+    lowPriorityDeferring_.store(false);
+    FutexPriorityMutex::lockLowPriority();
+    holdStart_ = nowNanoseconds();
+  }
+  void unlockLowPriority() override {
+    const int64_t hold = nowNanoseconds() - holdStart_;
+    predictedHold_ = predictedHold_ == 0 ? hold : (7 * predictedHold_ + hold) / 8;
+    FutexPriorityMutex::unlockLowPriority();
+  }
+
+  void lockHighPriority() override {
+    const int64_t now = nowNanoseconds();
+    const int64_t lastArrival = lastArrival_.exchange(now, memory_order_relaxed);
+    if (lastArrival != 0) {
+      const int64_t gap = now - lastArrival;
+      int64_t period = period_.load(memory_order_relaxed);
+      bool skipGap = false;
+      if (period != 0 && gap > kOutlierFactor * period) {
+        // One long gap is most likely a pause, like the one between two tests
+        // sharing this mutex, and is dropped. Two in a row mean the period
+        // really changed, so the average restarts from the new gap.
+        skipGap = !lastGapWasOutlier_;
+        lastGapWasOutlier_ = !lastGapWasOutlier_;
+        if (!skipGap) {
+          period = 0;
         }
-        winnerCountForLow[bestLowName] += 1;
-        winnerCountForHigh[bestHighName] += 1;
+      } else {
+        lastGapWasOutlier_ = false;
       }
+      if (!skipGap) {
+        period_.store(period == 0 ? gap : (7 * period + gap) / 8, memory_order_relaxed);
+      }
+    }
+    arrivals_.fetch_add(1);
+    if (lowPriorityDeferring_.load()) {
+      futexWake(arrivals_, INT_MAX);
     }
+    FutexPriorityMutex::lockHighPriority();
   }
-  cout << "Algorithm win counts for Low Priority Thread amount of work:" << endl;
-  for (const auto &i : winnerCountForLow) {
-    cout << "  " << i.first << ": " << i.second << endl;
+
+private:
+  static constexpr int64_t kOutlierFactor = 4;
+  atomic<int64_t> lastArrival_{0};
+  atomic<int64_t> period_{0};
+  atomic<uint32_t> arrivals_{0};
+  atomic<bool> lowPriorityDeferring_{false};
+  // Only touched by the high priority thread.
+  bool lastGapWasOutlier_{false};
+  // Only touched by the low priority thread.
+  int64_t holdStart_{0};
+  int64_t predictedHold_{0};
+};
+
+// Seqlock on top of FutexPriorityMutex. `sequence_` is odd only while the
+// resource is being modified: inside a low priority write section, or for the
+// whole of an exclusive high priority hold. The rest of a low priority hold
+// leaves it even, so readHighPriority() reads the resource without taking the
+// lock even while the trainer holds it, and re-runs the reader if the sequence
+// moved. A reader that finds a modification in progress waits for just that
+// modification to finish. One that keeps losing the race falls back to the
+// high priority lock instead of retrying forever.
+class SeqlockPriorityMutex : public FutexPriorityMutex {
+public:
+  void beginLowPriorityWrite() override {
+    beginWrite();
   }
-  cout << "Algorithm win counts for High Priority Thread lowest latency:" << endl;
-  for (const auto &i : winnerCountForHigh) {
-    cout << "  " << i.first << ": " << i.second << endl;
+  void endLowPriorityWrite() override {
+    endWrite();
+  }
+
+  void lockHighPriority() override {
+    FutexPriorityMutex::lockHighPriority();
+    beginWrite();
   }
+  void unlockHighPriority() override {
+    endWrite();
+    FutexPriorityMutex::unlockHighPriority();
+  }
+
+  int readHighPriority(const function<void()> &fn) override {
+    int retries = 0;
+    while (retries < kMaxOptimisticRetries) {
+      const uint32_t before = sequence_.load(memory_order_acquire);
+      if (before & 1) {
+        waitingReaders_.fetch_add(1);
+        futexWait(sequence_, before);
+        waitingReaders_.fetch_sub(1);
+        continue;
+      }
+      fn();
+      atomic_thread_fence(memory_order_acquire);
+      if (sequence_.load(memory_order_relaxed) == before) {
+        return retries;
+      }
+      ++retries;
+    }
+    return retries + PriorityMutex::readHighPriority(fn);
+  }
+
+private:
+  static constexpr int kMaxOptimisticRetries = 3;
+  atomic<uint32_t> sequence_{0};
+  atomic<int> waitingReaders_{0};
+
+  void beginWrite() {
+    sequence_.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+  }
+  void endWrite() {
+    sequence_.fetch_add(1);
+    if (waitingReaders_.load() > 0) {
+      futexWake(sequence_, INT_MAX);
+    }
+  }
+};
+
+// Delegation on top of FutexPriorityMutex. delegateHighPriority() posts the
+// request in `request_` and the thread holding the lock runs it at its next
+// safe point, which is a yield checkpoint or just before it unlocks, so the
+// resource never has to move to the requesting core. If the lock is free, the
+// requester takes it and runs the request itself. Requests are posted one at a
+// time.
+class DelegatingPriorityMutex : public FutexPriorityMutex {
+public:
+  void unlockLowPriority() override {
+    servePending();
+    FutexPriorityMutex::unlockLowPriority();
+    notifyRequester();
+  }
+  bool shouldYield() override {
+    return FutexPriorityMutex::shouldYield() || request_.load(memory_order_relaxed) != nullptr;
+  }
+  // Serves a posted request in place, and only gives up the lock if a thread
+  // is also waiting to take it.
+  void yieldToHighPriority() override {
+    servePending();
+    if (FutexPriorityMutex::shouldYield()) {
+      FutexPriorityMutex::yieldToHighPriority();
+    }
+  }
+  void unlockHighPriority() override {
+    servePending();
+    FutexPriorityMutex::unlockHighPriority();
+    notifyRequester();
+  }
+
+  void delegateHighPriority(const function<void()> &fn) override {
+    lock_guard<mutex> lock(requestMutex_);
+    done_.store(0);
+    request_.store(&fn);
+    while (done_.load() == 0) {
+      if (tryAcquire()) {
+        // The holder may have claimed the request just before releasing.
+        if (request_.exchange(nullptr) != nullptr) {
+          fn();
+          done_.store(1);
+        }
+        unlockHighPriority();
+        continue;
+      }
+      // Park until the holder either serves the request or releases the lock.
+      // Either one bumps `events_`, which the holder can do without touching
+      // the lock word.
+      const uint32_t events = events_.load();
+      requesterParked_.store(true);
+      if (done_.load() == 0 && state_.load() != kFree) {
+        futexWait(events_, events);
+      }
+      requesterParked_.store(false);
+    }
+  }
+
+private:
+  mutex requestMutex_;
+  atomic<const function<void()>*> request_{nullptr};
+  atomic<uint32_t> done_{0};
+  atomic<uint32_t> events_{0};
+  atomic<bool> requesterParked_{false};
+
+  void notifyRequester() {
+    events_.fetch_add(1);
+    if (requesterParked_.load()) {
+      futexWake(events_, 1);
+    }
+  }
+
+  void servePending() {
+    const function<void()> *request = request_.exchange(nullptr);
+    if (request == nullptr) {
+      return;
+    }
+    // The requester may return as soon as `done_` is set; `request` must not be
+    // touched after this.
+    (*request)();
+    done_.store(1);
+    notifyRequester();
+  }
+};
+
+// Reader-writer lock in which lockHighPriority() is a shared acquisition, so
+// any number of high priority threads can hold the resource at once. The low
+// priority thread is the only writer. `state_` holds the writer bit, a bit for
+// a parked writer, and the number of readers holding the lock; both sides park
+// on it. `readersPending_` counts readers that want the lock and, like
+// FutexPriorityMutex's pending counter, the writer parks on it while non-zero,
+// so readers are never held off by a writer that has not acquired yet.
+class ReaderWriterPriorityMutex : public PriorityMutex {
+public:
+  void lockLowPriority() override {
+    while (true) {
+      const uint32_t pending = readersPending_.load();
+      if (pending != 0) {
+        futexWait(readersPending_, pending);
+        continue;
+      }
+      uint32_t s = state_.load();
+      if ((s & ~kWriterParked) == 0) {
+        // Keep the parked bit; another writer may still be parked.
+        if (state_.compare_exchange_strong(s, kWriter | s)) {
+          return;
+        }
+        continue;
+      }
+      if (!(s & kWriterParked) && !state_.compare_exchange_strong(s, s | kWriterParked)) {
+        continue;
+      }
+      futexWait(state_, s | kWriterParked);
+    }
+  }
+  void unlockLowPriority() override {
+    if ((state_.exchange(0) & kWriterParked) || readersPending_.load() != 0) {
+      futexWake(state_, INT_MAX);
+    }
+  }
+  bool shouldYield() override {
+    return readersPending_.load(memory_order_relaxed) != 0;
+  }
+
+  void lockHighPriority() override {
+    readersPending_.fetch_add(1);
+    uint32_t s = state_.load();
+    while (true) {
+      if (s & kWriter) {
+        futexWait(state_, s);
+        s = state_.load();
+        continue;
+      }
+      if (state_.compare_exchange_weak(s, s + 1)) {
+        break;
+      }
+    }
+    if (readersPending_.fetch_sub(1) == 1) {
+      futexWake(readersPending_, INT_MAX);
+    }
+  }
+  void unlockHighPriority() override {
+    const uint32_t s = state_.fetch_sub(1);
+    if ((s & kReaderMask) == 1 && (s & kWriterParked)) {
+      futexWake(state_, INT_MAX);
+    }
+  }
+
+private:
+  static constexpr uint32_t kWriter = uint32_t{1} << 31;
+  static constexpr uint32_t kWriterParked = uint32_t{1} << 30;
+  static constexpr uint32_t kReaderMask = kWriterParked - 1;
+  atomic<uint32_t> state_{0};
+  atomic<uint32_t> readersPending_{0};
+};
+
+// Biased toward a single low priority thread. The low priority side only ever
+// does plain stores and loads: it announces itself in `ownerWants_` and checks
+// that no high priority thread is revoking. A high priority thread sets
+// `revoking_` and then runs membarrier(2), which forces a full barrier on every
+// running thread of the process, standing in for the fence the low priority
+// side leaves out. After that, either the low priority thread sees `revoking_`
+// and backs off, or the high priority thread sees `ownerWants_` and waits for
+// the unlock. High priority threads take turns through `revokeMutex_`.
+//
+// If expedited membarrier cannot be registered, the low priority side falls
+// back to a full fence of its own.
+class BiasedPriorityMutex : public PriorityMutex {
+public:
+  BiasedPriorityMutex() {
+    useFence_ = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) != 0;
+  }
+
+  void lockLowPriority() override {
+    while (true) {
+      ownerWants_.store(1, memory_order_relaxed);
+      ownerFence();
+      if (revoking_.load(memory_order_acquire) == 0) {
+        return;
+      }
+      ownerWants_.store(0, memory_order_release);
+      futexWake(ownerWants_, 1);
+      while (revoking_.load() != 0) {
+        futexWait(revoking_, 1);
+      }
+    }
+  }
+  void unlockLowPriority() override {
+    ownerWants_.store(0, memory_order_release);
+    ownerFence();
+    if (revoking_.load(memory_order_relaxed) != 0) {
+      futexWake(ownerWants_, 1);
+    }
+  }
+  bool shouldYield() override {
+    return revoking_.load(memory_order_relaxed) != 0;
+  }
+
+  void lockHighPriority() override {
+    revokeMutex_.lock();
+    revoking_.store(1);
+    if (!useFence_) {
+      syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    }
+    while (ownerWants_.load() != 0) {
+      futexWait(ownerWants_, 1);
+    }
+  }
+  void unlockHighPriority() override {
+    revoking_.store(0);
+    futexWake(revoking_, 1);
+    revokeMutex_.unlock();
+  }
+
+private:
+  bool useFence_;
+  atomic<uint32_t> ownerWants_{0};
+  atomic<uint32_t> revoking_{0};
+  mutex revokeMutex_;
+
+  // Pairs with the membarrier() in lockHighPriority(). Only a compiler barrier
+  // unless membarrier is unavailable.
+  void ownerFence() {
+    if (useFence_) {
+      atomic_thread_fence(memory_order_seq_cst);
+    } else {
+      atomic_signal_fence(memory_order_seq_cst);
+    }
+  }
+};
+
+// MCS-style queue lock. Every waiter spins on the `granted` flag of its own
+// cache-line-aligned node and the releaser hands ownership directly to the
+// first node in the queue. Low priority waiters enqueue at the tail; high
+// priority waiters jump ahead of every queued low priority waiter (but stay
+// FIFO among themselves). The queue links are only touched under `guard_`,
+// which is held for a handful of instructions and never while waiting.
+class McsPriorityMutex : public PriorityMutex {
+public:
+  void lockLowPriority() override {
+    acquire(/*highPriority=*/false);
+  }
+  void unlockLowPriority() override {
+    release();
+  }
+
+  void lockHighPriority() override {
+    acquire(/*highPriority=*/true);
+  }
+  void unlockHighPriority() override {
+    release();
+  }
+
+private:
+  struct alignas(64) Node {
+    Node *next{nullptr};
+    atomic<bool> granted{false};
+  };
+
+  SpinGuard guard_;
+  bool held_{false};
+  Node *head_{nullptr};
+  Node *tail_{nullptr};
+  Node *lastHighPriority_{nullptr};
+
+  void acquire(bool highPriority) {
+    Node node;
+    guard_.lock();
+    if (!held_) {
+      held_ = true;
+      guard_.unlock();
+      return;
+    }
+    if (!highPriority) {
+      if (tail_ == nullptr) {
+        head_ = &node;
+      } else {
+        tail_->next = &node;
+      }
+      tail_ = &node;
+    } else {
+      if (lastHighPriority_ == nullptr) {
+        node.next = head_;
+        head_ = &node;
+      } else {
+        node.next = lastHighPriority_->next;
+        lastHighPriority_->next = &node;
+      }
+      if (node.next == nullptr) {
+        tail_ = &node;
+      }
+      lastHighPriority_ = &node;
+    }
+    guard_.unlock();
+    while (!node.granted.load(memory_order_acquire)) {
+      cpuRelax();
+    }
+  }
+
+  void release() {
+    guard_.lock();
+    Node *next = head_;
+    if (next == nullptr) {
+      held_ = false;
+      guard_.unlock();
+      return;
+    }
+    head_ = next->next;
+    if (head_ == nullptr) {
+      tail_ = nullptr;
+    }
+    if (lastHighPriority_ == next) {
+      lastHighPriority_ = nullptr;
+    }
+    guard_.unlock();
+    // `next` lives on the waiter's stack; it must not be touched after this.
+    next->granted.store(true, memory_order_release);
+  }
+};
+
+// Ticket lock with two lanes packed into one word: a normal lane for the low
+// priority thread and an express lane for the high priority thread. On every
+// unlock the releaser serves the next express ticket first, then the next
+// normal ticket, and only releases the lock into the open when both lanes are
+// empty. An uncontended low priority lock/unlock is a single CAS each.
+class TicketPriorityMutex : public PriorityMutex {
+public:
+  void lockLowPriority() override {
+    acquire(kLowNextShift, kLowServingShift);
+  }
+  void unlockLowPriority() override {
+    release();
+  }
+  bool shouldYield() override {
+    const uint64_t state = state_.load(memory_order_relaxed);
+    return counter(state, kHighNextShift) != counter(state, kHighServingShift);
+  }
+
+  void lockHighPriority() override {
+    acquire(kHighNextShift, kHighServingShift);
+  }
+  void unlockHighPriority() override {
+    release();
+  }
+
+private:
+  static constexpr uint64_t kCounterMask = 0x7FFF;
+  static constexpr int kHighNextShift = 0;
+  static constexpr int kHighServingShift = 15;
+  static constexpr int kLowNextShift = 30;
+  static constexpr int kLowServingShift = 45;
+  static constexpr uint64_t kHeld = uint64_t{1} << 60;
+  atomic<uint64_t> state_{0};
+
+  static uint64_t counter(uint64_t state, int shift) {
+    return (state >> shift) & kCounterMask;
+  }
+  static uint64_t increment(uint64_t state, int shift) {
+    return (state & ~(kCounterMask << shift)) | (((counter(state, shift) + 1) & kCounterMask) << shift);
+  }
+
+  void acquire(int nextShift, int servingShift) {
+    uint64_t state = state_.load();
+    uint64_t ticket;
+    while (true) {
+      if (!(state & kHeld)) {
+        // Both lanes are always empty while the lock is free.
+        if (state_.compare_exchange_weak(state, state | kHeld)) {
+          return;
+        }
+        continue;
+      }
+      ticket = counter(state, nextShift);
+      if (state_.compare_exchange_weak(state, increment(state, nextShift))) {
+        break;
+      }
+    }
+    const uint64_t grantedValue = (ticket + 1) & kCounterMask;
+    while (counter(state_.load(memory_order_acquire), servingShift) != grantedValue) {
+      cpuRelax();
+    }
+  }
+
+  void release() {
+    uint64_t state = state_.load();
+    uint64_t desired;
+    do {
+      if (counter(state, kHighNextShift) != counter(state, kHighServingShift)) {
+        desired = increment(state, kHighServingShift);
+      } else if (counter(state, kLowNextShift) != counter(state, kLowServingShift)) {
+        desired = increment(state, kLowServingShift);
+      } else {
+        desired = state & ~kHeld;
+      }
+    } while (!state_.compare_exchange_weak(state, desired));
+  }
+};
+
+// Any number of priority levels (up to 64), each with its own FIFO queue of
+// parked waiters. `nonEmptyLevels_` has a bit set for every level with a queued
+// waiter, so unlock() finds the highest waiting level with a single
+// count-leading-zeros and hands ownership straight to the head of its queue.
+// As in McsPriorityMutex, the queues are only touched under `guard_`, which is
+// never held while waiting.
+class LeveledPriorityMutex : public PriorityMutex {
+public:
+  explicit LeveledPriorityMutex(int levels) : levels_(levels) {
+    if (levels < 1 || levels > 64) {
+      throw invalid_argument("LeveledPriorityMutex supports 1 to 64 levels");
+    }
+    queues_.resize(levels);
+  }
+
+  void lockLowPriority() override {
+    lock(0);
+  }
+  void unlockLowPriority() override {
+    unlock(0);
+  }
+
+  void lockHighPriority() override {
+    lock(levels_ - 1);
+  }
+  void unlockHighPriority() override {
+    unlock(levels_ - 1);
+  }
+
+  int priorityLevels() const override {
+    return levels_;
+  }
+  void lock(int priority) override {
+    if (priority < 0 || priority >= levels_) {
+      throw out_of_range("LeveledPriorityMutex priority out of range");
+    }
+    Waiter waiter;
+    guard_.lock();
+    if (!held_) {
+      held_ = true;
+      guard_.unlock();
+      return;
+    }
+    Queue &queue = queues_[priority];
+    if (queue.tail == nullptr) {
+      queue.head = &waiter;
+      nonEmptyLevels_ |= uint64_t{1} << priority;
+    } else {
+      queue.tail->next = &waiter;
+    }
+    queue.tail = &waiter;
+    guard_.unlock();
+    while (waiter.granted.load(memory_order_acquire) == 0) {
+      futexWait(waiter.granted, 0);
+    }
+  }
+  void unlock(int) override {
+    guard_.lock();
+    if (nonEmptyLevels_ == 0) {
+      held_ = false;
+      guard_.unlock();
+      return;
+    }
+    const int level = 63 - __builtin_clzll(nonEmptyLevels_);
+    Queue &queue = queues_[level];
+    Waiter *next = queue.head;
+    queue.head = next->next;
+    if (queue.head == nullptr) {
+      queue.tail = nullptr;
+      nonEmptyLevels_ &= ~(uint64_t{1} << level);
+    }
+    guard_.unlock();
+    // `next` lives on the waiter's stack and may be gone as soon as it is
+    // granted. A wake on the stale address is at worst spurious, and every
+    // futex waiter in this file re-checks its condition.
+    next->granted.store(1, memory_order_release);
+    futexWake(next->granted, 1);
+  }
+
+private:
+  struct Waiter {
+    Waiter *next{nullptr};
+    atomic<uint32_t> granted{0};
+  };
+  struct Queue {
+    Waiter *head{nullptr};
+    Waiter *tail{nullptr};
+  };
+
+  const int levels_;
+  SpinGuard guard_;
+  bool held_{false};
+  uint64_t nonEmptyLevels_{0};
+  vector<Queue> queues_;
+};
+
+// Earliest deadline first. Waiters park on their own node in a queue kept
+// sorted by deadline, and release() hands ownership straight to the head. Low
+// priority waiters have no deadline and queue behind every high priority
+// waiter; lockHighPriority() without a deadline sorts after every deadline but
+// still ahead of the low priority waiters. Ties are
+// served in arrival order. The queue is expected to be short, so insertion is
+// a linear walk, done under `guard_` as in LeveledPriorityMutex.
+class EdfPriorityMutex : public PriorityMutex {
+public:
+  void lockLowPriority() override {
+    acquire(kLowPriorityKey);
+  }
+  void unlockLowPriority() override {
+    release();
+  }
+
+  void lockHighPriority() override {
+    acquire(kHighPriorityKey);
+  }
+  void unlockHighPriority() override {
+    release();
+  }
+
+  void lockWithDeadline(chrono::steady_clock::time_point deadline) override {
+    acquire(deadline);
+  }
+  void unlockWithDeadline() override {
+    release();
+  }
+
+private:
+  // Queue keys for acquisitions without a deadline. High priority ones sort
+  // after every real deadline but still ahead of every low priority waiter.
+  static constexpr chrono::steady_clock::time_point kLowPriorityKey = chrono::steady_clock::time_point::max();
+  static constexpr chrono::steady_clock::time_point kHighPriorityKey = kLowPriorityKey - chrono::steady_clock::duration{1};
+
+  struct Waiter {
+    chrono::steady_clock::time_point deadline;
+    Waiter *next{nullptr};
+    atomic<uint32_t> granted{0};
+  };
+
+  SpinGuard guard_;
+  bool held_{false};
+  Waiter *head_{nullptr};
+
+  void acquire(chrono::steady_clock::time_point deadline) {
+    Waiter waiter;
+    waiter.deadline = deadline;
+    guard_.lock();
+    if (!held_) {
+      held_ = true;
+      guard_.unlock();
+      return;
+    }
+    Waiter **link = &head_;
+    while (*link != nullptr && (*link)->deadline <= deadline) {
+      link = &(*link)->next;
+    }
+    waiter.next = *link;
+    *link = &waiter;
+    guard_.unlock();
+    while (waiter.granted.load(memory_order_acquire) == 0) {
+      futexWait(waiter.granted, 0);
+    }
+  }
+
+  void release() {
+    guard_.lock();
+    Waiter *next = head_;
+    if (next == nullptr) {
+      held_ = false;
+      guard_.unlock();
+      return;
+    }
+    head_ = next->next;
+    guard_.unlock();
+    // See LeveledPriorityMutex::unlock() about waking a node that may be gone.
+    next->granted.store(1, memory_order_release);
+    futexWake(next->granted, 1);
+  }
+};
+
+// Decorator that caps the low priority thread's share of the resource with a
+// token bucket whose tokens are nanoseconds of hold time. The bucket refills at
+// `dutyCycle` nanoseconds per nanosecond, up to `burst`, and every low priority
+// hold is charged its duration at unlock. lockLowPriority() sleeps until the
+// bucket is no longer in debt before acquiring. The high priority side passes
+// straight through. Supports a single low priority thread.
+class RateLimitedPriorityMutex : public PriorityMutex {
+public:
+  RateLimitedPriorityMutex(PriorityMutex *priorityMutex, double dutyCycle, chrono::nanoseconds burst = chrono::milliseconds{10}) :
+                              priorityMutex_(priorityMutex),
+                              dutyCycle_(dutyCycle),
+                              burst_(burst.count()),
+                              tokens_(burst.count()) {}
+
+  void lockLowPriority() override {
+    refill();
+    if (tokens_ < 0) {
+      sleepUntil(lastRefill_ + static_cast<int64_t>(-tokens_ / dutyCycle_));
+      refill();
+    }
+    priorityMutex_->lockLowPriority();
+    holdStart_ = nowNanoseconds();
+  }
+  void unlockLowPriority() override {
+    tokens_ -= nowNanoseconds() - holdStart_;
+    priorityMutex_->unlockLowPriority();
+  }
+  bool shouldYield() override {
+    return priorityMutex_->shouldYield();
+  }
+  void yieldToHighPriority() override {
+    priorityMutex_->yieldToHighPriority();
+  }
+  void endLowPriorityLease() override {
+    priorityMutex_->endLowPriorityLease();
+  }
+  void beginLowPriorityWrite() override {
+    priorityMutex_->beginLowPriorityWrite();
+  }
+  void endLowPriorityWrite() override {
+    priorityMutex_->endLowPriorityWrite();
+  }
+
+  void lockHighPriority() override {
+    priorityMutex_->lockHighPriority();
+  }
+  void unlockHighPriority() override {
+    priorityMutex_->unlockHighPriority();
+  }
+
+  // Only level 0 is rate limited; every other level passes straight through.
+  int priorityLevels() const override {
+    return priorityMutex_->priorityLevels();
+  }
+  void lock(int priority) override {
+    if (priority == 0) {
+      lockLowPriority();
+    } else {
+      priorityMutex_->lock(priority);
+    }
+  }
+  void unlock(int priority) override {
+    if (priority == 0) {
+      unlockLowPriority();
+    } else {
+      priorityMutex_->unlock(priority);
+    }
+  }
+
+  void lockWithDeadline(chrono::steady_clock::time_point deadline) override {
+    priorityMutex_->lockWithDeadline(deadline);
+  }
+  void unlockWithDeadline() override {
+    priorityMutex_->unlockWithDeadline();
+  }
+  int readHighPriority(const function<void()> &fn) override {
+    return priorityMutex_->readHighPriority(fn);
+  }
+  void delegateHighPriority(const function<void()> &fn) override {
+    priorityMutex_->delegateHighPriority(fn);
+  }
+
+private:
+  PriorityMutex *priorityMutex_;
+  const double dutyCycle_;
+  const int64_t burst_;
+  // Only touched by the low priority thread.
+  double tokens_;
+  int64_t lastRefill_{nowNanoseconds()};
+  int64_t holdStart_{0};
+
+  void refill() {
+    const int64_t now = nowNanoseconds();
+    tokens_ = min(static_cast<double>(burst_), tokens_ + (now - lastRefill_) * dutyCycle_);
+    lastRefill_ = now;
+  }
+};
+
+// An alternative to mutual exclusion: the low priority thread trains on its
+// own private copy of the resource and periodically publishes it, while the
+// high priority thread reads whatever was published last.
+class PublishedResource {
+public:
+  // Low priority side: makes a copy of `data` visible to readers.
+  virtual void publish(const vector<uint8_t> &data) = 0;
+  // High priority side: runs `fn` against the latest published copy.
+  virtual void read(const function<void(const vector<uint8_t>&)> &fn) = 0;
+  // Returns the most bytes held in copies of the resource at any one time
+  // since the last call, including copies only kept alive for readers.
+  virtual size_t takePeakRetainedBytes() = 0;
+};
+
+// Two buffers and an atomic index of the published one. publish() copies into
+// the buffer that is not published and then swaps the index. Readers never
+// wait on the publisher; they only retry if the index moved while they were
+// registering. The publisher instead waits for any reader still on the back
+// buffer to leave before overwriting it.
+class DoubleBufferedResource : public PublishedResource {
+public:
+  void publish(const vector<uint8_t> &data) override {
+    // Only the publisher changes `published_`.
+    const int back = 1 - published_.load(memory_order_relaxed);
+    while (readers_[back].count.load() != 0) {
+      this_thread::yield();
+    }
+    buffers_[back] = data;
+    published_.store(back);
+  }
+
+  void read(const function<void(const vector<uint8_t>&)> &fn) override {
+    int index;
+    while (true) {
+      index = published_.load();
+      readers_[index].count.fetch_add(1);
+      if (published_.load() == index) {
+        break;
+      }
+      readers_[index].count.fetch_sub(1);
+    }
+    fn(buffers_[index]);
+    readers_[index].count.fetch_sub(1, memory_order_release);
+  }
+
+  size_t takePeakRetainedBytes() override {
+    // Only the publisher resizes the buffers, and it is not running here.
+    return buffers_[0].capacity() + buffers_[1].capacity();
+  }
+
+private:
+  struct alignas(64) ReaderCount {
+    atomic<int> count{0};
+  };
+
+  vector<uint8_t> buffers_[2];
+  atomic<int> published_{0};
+  ReaderCount readers_[2];
+};
+
+// Read-copy-update with epoch-based reclamation. publish() copies the data
+// into a freshly allocated version, swaps it in, and retires the old version
+// tagged with the current epoch. Readers register in the current epoch (by its
+// parity, retrying if it moved while they registered, as DoubleBufferedResource
+// does with its index) and read whatever version is current. The publisher
+// advances the epoch once no reader is left in the previous one; a version
+// retired in epoch `e` is freed once the epoch reaches `e + 2`, when no reader
+// can still hold it.
+//
+// A reader that holds a version for a long time blocks every newer version from
+// being freed. To bound memory, once `maxRetiredVersions` are waiting the
+// publisher waits for a grace period instead of allocating another.
+class RcuResource : public PublishedResource {
+public:
+  explicit RcuResource(size_t maxRetiredVersions = 8) : maxRetiredVersions_(maxRetiredVersions) {}
+
+  ~RcuResource() {
+    for (auto &retired : retired_) {
+      delete retired.version;
+    }
+    delete current_.load();
+  }
+
+  void publish(const vector<uint8_t> &data) override {
+    while (retired_.size() >= maxRetiredVersions_ && !reclaim()) {
+      this_thread::yield();
+    }
+    vector<uint8_t> *version = new vector<uint8_t>(data);
+    retainedBytes_ += version->capacity();
+    vector<uint8_t> *old = current_.exchange(version);
+    if (old != nullptr) {
+      retired_.push_back({old, globalEpoch_.load()});
+    }
+    reclaim();
+    peakRetainedBytes_ = max(peakRetainedBytes_, retainedBytes_);
+  }
+
+  void read(const function<void(const vector<uint8_t>&)> &fn) override {
+    uint64_t epoch;
+    while (true) {
+      epoch = globalEpoch_.load();
+      readers_[epoch & 1].count.fetch_add(1);
+      if (globalEpoch_.load() == epoch) {
+        break;
+      }
+      readers_[epoch & 1].count.fetch_sub(1);
+    }
+    const vector<uint8_t> *version = current_.load();
+    fn(version != nullptr ? *version : kEmpty);
+    readers_[epoch & 1].count.fetch_sub(1, memory_order_release);
+  }
+
+  size_t takePeakRetainedBytes() override {
+    const size_t peak = peakRetainedBytes_;
+    peakRetainedBytes_ = retainedBytes_;
+    return peak;
+  }
+
+private:
+  struct alignas(64) ReaderCount {
+    atomic<int> count{0};
+  };
+  struct Retired {
+    vector<uint8_t> *version;
+    uint64_t epoch;
+  };
+
+  static inline const vector<uint8_t> kEmpty;
+  const size_t maxRetiredVersions_;
+  atomic<vector<uint8_t>*> current_{nullptr};
+  // Starts at 1 so that no reader is ever in the epoch before it.
+  atomic<uint64_t> globalEpoch_{1};
+  ReaderCount readers_[2];
+  // Only touched by the publisher.
+  vector<Retired> retired_;
+  size_t retainedBytes_{0};
+  size_t peakRetainedBytes_{0};
+
+  // Advances the epoch as far as readers allow and frees every version no
+  // reader can still hold. Returns whether anything was freed.
+  bool reclaim() {
+    uint64_t epoch = globalEpoch_.load(memory_order_relaxed);
+    // Readers of epoch `epoch - 1` share a counter with epoch `epoch + 1`, so
+    // the epoch can only move on once they have all left.
+    while (!retired_.empty() && retired_.front().epoch + 2 > epoch &&
+           readers_[(epoch + 1) & 1].count.load() == 0) {
+      globalEpoch_.store(++epoch);
+    }
+    size_t freed = 0;
+    while (freed < retired_.size() && retired_[freed].epoch + 2 <= epoch) {
+      retainedBytes_ -= retired_[freed].version->capacity();
+      delete retired_[freed].version;
+      ++freed;
+    }
+    retired_.erase(retired_.begin(), retired_.begin() + freed);
+    return freed > 0;
+  }
+};
+
+// Clock for the benchmark's own measurements. Reads the TSC when it is
+// invariant, converted to nanoseconds with a rate measured against
+// CLOCK_MONOTONIC_RAW, and reads CLOCK_MONOTONIC_RAW directly otherwise.
+// calibrate() also measures what a single read costs, and elapsed() subtracts
+// that from every interval so the smallest intervals are not inflated by the
+// clock itself. Call calibrate() once before any thread uses the clock.
+class BenchmarkClock {
+public:
+  static void calibrate() {
+    constexpr int kOverheadReads = 1'000'000;
+    useTsc_ = false;
+    const int64_t monotonicOverhead = measureOverhead(kOverheadReads);
+    overhead_ = monotonicOverhead;
+    if (!hasInvariantTsc()) {
+      printf("Clock: CLOCK_MONOTONIC_RAW, read overhead: %lld ns\n", static_cast<long long>(overhead_));
+      return;
+    }
+    const int64_t startNanoseconds = monotonicNow();
+    const uint64_t startTicks = readTsc();
+    this_thread::sleep_for(chrono::milliseconds{100});
+    const int64_t endNanoseconds = monotonicNow();
+    const uint64_t endTicks = readTsc();
+    nanosecondsPerTick_ = static_cast<double>(endNanoseconds - startNanoseconds) / (endTicks - startTicks);
+    baseTicks_ = endTicks;
+    baseNanoseconds_ = endNanoseconds;
+    useTsc_ = true;
+    overhead_ = measureOverhead(kOverheadReads);
+    printf("Clock: TSC at %.3f GHz, read overhead: %lld ns (CLOCK_MONOTONIC_RAW: %lld ns)\n",
+           1.0 / nanosecondsPerTick_, static_cast<long long>(overhead_), static_cast<long long>(monotonicOverhead));
+  }
+
+  // Nanoseconds on the same scale as CLOCK_MONOTONIC_RAW.
+  static int64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (useTsc_) {
+      return baseNanoseconds_ + static_cast<int64_t>(static_cast<int64_t>(readTsc() - baseTicks_) * nanosecondsPerTick_);
+    }
+#endif
+    return monotonicNow();
+  }
+
+  // Time between two reads of now(), less the cost of a read.
+  static int64_t elapsed(int64_t start, int64_t end) {
+    return std::max<int64_t>(0, end - start - overhead_);
+  }
+
+private:
+  static inline bool useTsc_ = false;
+  static inline double nanosecondsPerTick_ = 0;
+  static inline uint64_t baseTicks_ = 0;
+  static inline int64_t baseNanoseconds_ = 0;
+  static inline int64_t overhead_ = 0;
+
+  static int64_t monotonicNow() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1'000'000'000 + time.tv_nsec;
+  }
+  static uint64_t readTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    // rdtscp waits for earlier instructions, so the read is not hoisted
+    // above the work being timed.
+    unsigned int processor;
+    return __rdtscp(&processor);
+#else
+    return 0;
+#endif
+  }
+  static bool hasInvariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 27))) {
+      // No rdtscp.
+      return false;
+    }
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#else
+    return false;
+#endif
+  }
+  static int64_t measureOverhead(int reads) {
+    const int64_t start = now();
+    for (int i = 1; i < reads; ++i) {
+      now();
+    }
+    return (now() - start) / reads;
+  }
+};
+
+// Log-bucketed latency histogram in the style of HdrHistogram. Values below 32
+// get a bucket each; above that, every power of two is split into 16 buckets,
+// so a recorded value is off by at most 1/16 of itself. Recording only
+// increments a counter in a fixed-size array, so it never allocates.
+class LatencyHistogram {
+public:
+  void record(int64_t value) {
+    ++counts_[bucketIndex(static_cast<uint64_t>(value < 0 ? 0 : value))];
+    ++count_;
+    max_ = std::max(max_, value);
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  int64_t count() const {
+    return count_;
+  }
+  int64_t max() const {
+    return max_;
+  }
+
+  // Smallest value that at least `percent` percent of the recorded values are
+  // no greater than, rounded up to the end of its bucket.
+  int64_t percentile(double percent) const {
+    const int64_t target = std::max<int64_t>(1, static_cast<int64_t>(percent / 100.0 * count_ + 0.5));
+    int64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= target) {
+        return std::min(bucketUpperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+private:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr uint64_t kSubBucketCount = uint64_t{1} << kSubBucketBits;
+  static constexpr uint64_t kHalfSubBucketCount = kSubBucketCount / 2;
+  static constexpr size_t kBucketCount = (64 - kSubBucketBits + 2) * kHalfSubBucketCount;
+  array<int64_t, kBucketCount> counts_{};
+  int64_t count_{0};
+  int64_t max_{0};
+
+  static size_t bucketIndex(uint64_t value) {
+    if (value < kSubBucketCount) {
+      return value;
+    }
+    const int shift = 63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+    return (shift + 1) * kHalfSubBucketCount + ((value >> shift) - kHalfSubBucketCount);
+  }
+  static int64_t bucketUpperBound(size_t index) {
+    if (index < kSubBucketCount) {
+      return index;
+    }
+    const int shift = index / kHalfSubBucketCount - 1;
+    const uint64_t subBucket = index % kHalfSubBucketCount + kHalfSubBucketCount;
+    return static_cast<int64_t>(((subBucket + 1) << shift) - 1);
+  }
+};
+
+// perf_event_open counters for the calling thread, counting from construction
+// until read(). Hardware events are opened as one group so they are scheduled
+// onto the PMU together and their ratios are meaningful; software events never
+// multiplex and are opened on their own. Hardware events are usually missing in
+// VMs, in which case only the software events are reported.
+class PerfCounters {
+public:
+  enum Event {
+    kContextSwitches,
+    kCpuMigrations,
+    kPageFaults,
+    kTaskClock,
+    kCycles,
+    kInstructions,
+    kCacheMisses,
+    kEventCount
+  };
+
+  // A count of -1 means the event could not be opened.
+  struct Counts {
+    array<int64_t, kEventCount> values;
+
+    Counts() { values.fill(-1); }
+
+    void merge(const Counts &other) {
+      for (int i = 0; i < kEventCount; ++i) {
+        if (other.values[i] >= 0) {
+          values[i] = std::max<int64_t>(values[i], 0) + other.values[i];
+        }
+      }
+    }
+
+    // Formatted to be appended to the standard result line, with `role`
+    // naming whose counts these are.
+    string format(const char *role) const {
+      static constexpr const char *kNames[kEventCount] = {
+          "Context Switches", "CPU Migrations", "Page Faults", "Task Clock", "Cycles", "Instructions", "Cache Misses"};
+      string result;
+      char buffer[64];
+      for (int i = 0; i < kEventCount; ++i) {
+        const char *prefix = i == 0 ? role : "";
+        const char *space = i == 0 ? " " : "";
+        if (values[i] < 0) {
+          snprintf(buffer, sizeof(buffer), ", %s%s%s: %12s", prefix, space, kNames[i], "n/a");
+        } else {
+          snprintf(buffer, sizeof(buffer), ", %s%s%s: %12lld", prefix, space, kNames[i], static_cast<long long>(values[i]));
+        }
+        result += buffer;
+      }
+      return result;
+    }
+  };
+
+  PerfCounters() {
+    fds_.fill(-1);
+    // Cycles lead the hardware group; the others are only opened if it is.
+    fds_[kCycles] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fds_[kCycles] >= 0) {
+      fds_[kInstructions] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds_[kCycles]);
+      fds_[kCacheMisses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds_[kCycles]);
+    }
+    fds_[kContextSwitches] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1);
+    fds_[kCpuMigrations] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, -1);
+    fds_[kPageFaults] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1);
+    fds_[kTaskClock] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1);
+    if (fds_[kCycles] >= 0) {
+      ioctl(fds_[kCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    for (int i = 0; i < kCycles; ++i) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters &operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  Counts read() const {
+    Counts counts;
+    for (int i = 0; i < kCycles; ++i) {
+      uint64_t value;
+      if (fds_[i] >= 0 && ::read(fds_[i], &value, sizeof(value)) == sizeof(value)) {
+        counts.values[i] = static_cast<int64_t>(value);
+      }
+    }
+    if (fds_[kCycles] < 0) {
+      return counts;
+    }
+    // PERF_FORMAT_GROUP: the member count, the times enabled and running, then
+    // one value per member in the order they were opened.
+    uint64_t group[3 + kEventCount - kCycles];
+    const ssize_t bytes = ::read(fds_[kCycles], group, sizeof(group));
+    if (bytes < static_cast<ssize_t>(3 * sizeof(uint64_t)) || group[2] == 0) {
+      return counts;
+    }
+    // Scale up for the time the group was multiplexed off the PMU.
+    const double scale = static_cast<double>(group[1]) / group[2];
+    uint64_t member = 0;
+    for (int i = kCycles; i < kEventCount && member < group[0]; ++i) {
+      if (fds_[i] >= 0) {
+        counts.values[i] = static_cast<int64_t>(group[3 + member++] * scale);
+      }
+    }
+    return counts;
+  }
+
+private:
+  array<int, kEventCount> fds_;
+
+  // Counts kernel time too where allowed, since that is where futex waits and
+  // context switches happen, and user time only otherwise.
+  static int open(uint32_t type, uint64_t config, int groupFd) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = groupFd < 0;
+    attr.exclude_hv = 1;
+    if (type == PERF_TYPE_HARDWARE && groupFd < 0) {
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    }
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && errno == EACCES) {
+      attr.exclude_kernel = 1;
+      fd = syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+  }
+};
+
+// Two types of workers:
+//  1. "Trainer": Tight loop, needs resource for entire body.
+//  2. "Server": Only needs resource for small fraction of body.
+class ContentionTest {
+public:
+  enum class HighPriorityAccess {
+    // lockHighPriority(), work, unlockHighPriority().
+    kLock,
+    // readHighPriority() around the work. Latency is measured end-to-end,
+    // including the work itself and any retries.
+    kOptimisticRead,
+    // delegateHighPriority() with the work as the request. Latency is measured
+    // from posting the request until it has been served, including the work.
+    kDelegate
+  };
+
+  enum class ThreadScheduling {
+    // Every thread runs under the default time-sharing policy.
+    kDefault,
+    // SCHED_FIFO or SCHED_RR, with the high priority thread above the low
+    // priority one. Without CAP_SYS_NICE, falls back to raising the nice
+    // value of the lower priority threads.
+    kFifo,
+    kRoundRobin
+  };
+
+  ContentionTest(PriorityMutex *priorityMutex,
+                 chrono::microseconds lowPrioWorkTime,
+                 chrono::microseconds highPrioWorkTime,
+                 chrono::microseconds highPrioSleepTime) :
+                    priorityMutex_(priorityMutex),
+                    lowPrioWorkTime_(lowPrioWorkTime),
+                    highPrioWorkTime_(highPrioWorkTime),
+                    highPrioSleepTime_(highPrioSleepTime) {}
+
+  // Instead of locking, the low priority thread trains on a private copy of
+  // the resource and publishes it after every step; the high priority thread
+  // reads the latest published copy.
+  ContentionTest(PublishedResource *publishedResource,
+                 chrono::microseconds lowPrioWorkTime,
+                 chrono::microseconds highPrioWorkTime,
+                 chrono::microseconds highPrioSleepTime) :
+                    ContentionTest(static_cast<PriorityMutex*>(nullptr), lowPrioWorkTime, highPrioWorkTime, highPrioSleepTime) {
+    publishedResource_ = publishedResource;
+  }
+
+  pair<double, double> run() {
+    if (publishedResource_ != nullptr) {
+      // Forget the peak left over from whichever test used it last.
+      publishedResource_->takePeakRetainedBytes();
+    }
+    if (hasCpuHog_) {
+      cpu_ = sched_getcpu();
+    }
+    threadsReady_ = make_unique<latch>(1 + highPriorityThreadCount_ + (hasCheckpoint_ ? 1 : 0));
+    thread thr1(std::bind(&ContentionTest::lowPriorityThreadFunction, this));
+    vector<thread> highPriorityThreads;
+    for (int i = 0; i < highPriorityThreadCount_; ++i) {
+      highPriorityThreads.emplace_back(std::bind(&ContentionTest::highPriorityThreadFunction, this));
+    }
+    thread checkpointThread;
+    if (hasCheckpoint_) {
+      checkpointThread = thread(std::bind(&ContentionTest::checkpointThreadFunction, this));
+    }
+    thread cpuHogThread;
+    if (hasCpuHog_) {
+      // Setup, like opening perf counters, can depend on kernel threads the hog
+      // would starve, so it only starts once every test thread is ready.
+      threadsReady_->wait();
+      cpuHogThread = thread(std::bind(&ContentionTest::cpuHogThreadFunction, this));
+    }
+    this_thread::sleep_for(kTestDurationSeconds);
+    shouldRun_ = false;
+    thr1.join();
+    for (auto &thr : highPriorityThreads) {
+      thr.join();
+    }
+    if (checkpointThread.joinable()) {
+      checkpointThread.join();
+    }
+    if (cpuHogThread.joinable()) {
+      cpuHogThread.join();
+    }
+    return {lowPriorityThreadWorkTime_, highPriorityThreadLatencyTime_};
+  }
+
+  void setHighPriorityAccess(HighPriorityAccess highPriorityAccess) {
+    highPriorityAccess_ = highPriorityAccess;
+  }
+
+  // Number of identical high priority threads. The reported high priority
+  // latency is the total across all of them.
+  void setHighPriorityThreadCount(int count) {
+    highPriorityThreadCount_ = count;
+  }
+
+  // Gives every high priority acquisition a deadline, cycling through
+  // `deadlines` (measured from when the acquisition starts), and reports how
+  // often the lock was acquired after its deadline. Only applies to
+  // HighPriorityAccess::kLock.
+  void setHighPriorityDeadlines(vector<chrono::microseconds> deadlines) {
+    highPriorityDeadlines_ = std::move(deadlines);
+  }
+
+  // Splits each low priority hold into `chunks` equal chunks of work with a
+  // shouldYield() checkpoint between each. Only applies when testing a
+  // PriorityMutex. Time spent yielding is not counted as work.
+  void setLowPriorityWorkChunks(int chunks) {
+    lowPriorityWorkChunks_ = chunks;
+  }
+
+  // Adds a third class of accessor, like a periodic checkpoint or evaluation,
+  // that holds the resource for `workTime` after every `sleepTime`. It locks at
+  // level 1 of implementations with more than two priority levels, between the
+  // other two threads, and as a second low priority thread otherwise. Only
+  // supported when testing a PriorityMutex.
+  void setCheckpoint(chrono::microseconds workTime, chrono::microseconds sleepTime) {
+    hasCheckpoint_ = true;
+    checkpointWorkTime_ = workTime;
+    checkpointSleepTime_ = sleepTime;
+  }
+
+  void setThreadScheduling(ThreadScheduling threadScheduling) {
+    threadScheduling_ = threadScheduling;
+  }
+
+  // Adds a thread that never touches the resource and spins for the whole
+  // test at a scheduling priority between the other two. Every test thread is
+  // pinned to one CPU, so a low priority holder can be kept off the CPU by the
+  // hog while the high priority thread waits on it.
+  void setCpuHog(bool cpuHog) {
+    hasCpuHog_ = cpuHog;
+  }
+
+  // Size of the shared resource. On top of sleeping, each low priority step
+  // overwrites the whole resource and each high priority access reads all of
+  // it, so the cost of copying it can be compared against lock-wait latency.
+  void setResourceSize(size_t bytes) {
+    resource_.assign(bytes, 0);
+  }
+
+  // Extra statistics for the modes enabled on this test, formatted to be
+  // appended to the standard result line. Only valid after run().
+  string details() const {
+    string result;
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), ", High p50: %10lld, p90: %10lld, p99: %10lld, p99.9: %10lld, Max: %10lld",
+             static_cast<long long>(highPriorityLatencyHistogram_.percentile(50)),
+             static_cast<long long>(highPriorityLatencyHistogram_.percentile(90)),
+             static_cast<long long>(highPriorityLatencyHistogram_.percentile(99)),
+             static_cast<long long>(highPriorityLatencyHistogram_.percentile(99.9)),
+             static_cast<long long>(highPriorityLatencyHistogram_.max()));
+    result += buffer;
+    snprintf(buffer, sizeof(buffer), ", Low Steps/s: %10.0f", static_cast<double>(lowPriorityStepCount_) / kTestDurationSeconds.count());
+    result += buffer;
+    if (publishedResource_ == nullptr) {
+      snprintf(buffer, sizeof(buffer), ", Low Gap p50: %10lld, p99: %10lld, Max: %10lld",
+               static_cast<long long>(lowPriorityGapHistogram_.percentile(50)),
+               static_cast<long long>(lowPriorityGapHistogram_.percentile(99)),
+               static_cast<long long>(lowPriorityGapHistogram_.max()));
+      result += buffer;
+      result += formatHandoff("Handoff Low->High", lowToHighHandoffHistogram_);
+      result += formatHandoff("High->Low", highToLowHandoffHistogram_);
+    }
+    result += lowPriorityPerfCounts_.format("Low");
+    result += highPriorityPerfCounts_.format("High");
+    if (highPriorityThreadCount_ > 1) {
+      snprintf(buffer, sizeof(buffer), ", High Priority Threads: %3d, Mean Latency: %12.0f", highPriorityThreadCount_, highPriorityAccessCount_ == 0 ? 0.0 : highPriorityThreadLatencyTime_ / highPriorityAccessCount_);
+      result += buffer;
+    }
+    if (!highPriorityDeadlines_.empty()) {
+      snprintf(buffer, sizeof(buffer), ", Deadline Miss Rate: %8.4f", highPriorityAccessCount_ == 0 ? 0.0 : static_cast<double>(highPriorityDeadlineMissCount_) / highPriorityAccessCount_);
+      result += buffer;
+    }
+    if (lowPriorityWorkChunks_ > 1) {
+      snprintf(buffer, sizeof(buffer), ", Yields: %10lld", static_cast<long long>(lowPriorityYieldCount_));
+      result += buffer;
+    }
+    if (hasCheckpoint_) {
+      snprintf(buffer, sizeof(buffer), ", Checkpoint Latency: %12.0f", checkpointLatencyTime_);
+      result += buffer;
+    }
+    if (threadScheduling_ != ThreadScheduling::kDefault || hasCpuHog_) {
+      const char *scheduling = threadScheduling_ == ThreadScheduling::kDefault ? "SCHED_OTHER" : usedNiceFallback_ ? "nice" : threadScheduling_ == ThreadScheduling::kFifo ? "SCHED_FIFO" : "SCHED_RR";
+      snprintf(buffer, sizeof(buffer), ", Scheduling: %s%s", scheduling, hasCpuHog_ ? ", CPU Hog" : "");
+      result += buffer;
+    }
+    if (highPriorityAccess_ == HighPriorityAccess::kOptimisticRead) {
+      snprintf(buffer, sizeof(buffer), ", Read Retry Rate: %8.4f", highPriorityAccessCount_ == 0 ? 0.0 : static_cast<double>(highPriorityRetryCount_) / highPriorityAccessCount_);
+      result += buffer;
+    }
+    if (publishedResource_ != nullptr) {
+      snprintf(buffer, sizeof(buffer), ", Publish Time: %12.0f, Peak Retained: %12zu", publishTime_, peakRetainedBytes_);
+      result += buffer;
+    }
+    return result;
+  }
+
+private:
+  static constexpr chrono::seconds kTestDurationSeconds{120};
+  // Relative scheduling priority of each class of thread.
+  static constexpr int kLowRank = 0;
+  static constexpr int kMiddleRank = 1;
+  static constexpr int kHighRank = 2;
+  PriorityMutex *priorityMutex_;
+  PublishedResource *publishedResource_{nullptr};
+  const chrono::microseconds lowPrioWorkTime_;
+  const chrono::microseconds highPrioWorkTime_;
+  const chrono::microseconds highPrioSleepTime_;
+  mutex workMutex_;
+  atomic<bool> shouldRun_{true};
+  HighPriorityAccess highPriorityAccess_{HighPriorityAccess::kLock};
+  int highPriorityThreadCount_{1};
+  vector<chrono::microseconds> highPriorityDeadlines_;
+  int lowPriorityWorkChunks_{1};
+  int64_t lowPriorityYieldCount_{0};
+  bool hasCheckpoint_{false};
+  chrono::microseconds checkpointWorkTime_{0};
+  chrono::microseconds checkpointSleepTime_{0};
+  double checkpointLatencyTime_{0};
+  ThreadScheduling threadScheduling_{ThreadScheduling::kDefault};
+  atomic<bool> usedNiceFallback_{false};
+  bool hasCpuHog_{false};
+  int cpu_{0};
+  // Counted down by each test thread once it is set up and about to start.
+  unique_ptr<latch> threadsReady_;
+  double lowPriorityThreadWorkTime_;
+  int64_t lowPriorityStepCount_{0};
+  // Time from the end of each low priority hold to the start of the next.
+  LatencyHistogram lowPriorityGapHistogram_;
+  // Totals across the high priority threads, guarded by `workMutex_`.
+  double highPriorityThreadLatencyTime_{0};
+  LatencyHistogram highPriorityLatencyHistogram_;
+  LatencyHistogram lowToHighHandoffHistogram_;
+  // Written by the low priority thread only.
+  LatencyHistogram highToLowHandoffHistogram_;
+  // Written by the low priority thread only.
+  PerfCounters::Counts lowPriorityPerfCounts_;
+  // Summed across the high priority threads, guarded by `workMutex_`.
+  PerfCounters::Counts highPriorityPerfCounts_;
+  // The most recent release, written just before unlocking and read just after
+  // locking, so the lock itself orders them.
+  atomic<int64_t> lastReleaseTime_{0};
+  atomic<bool> lastReleaseWasHighPriority_{false};
+  int64_t highPriorityAccessCount_{0};
+  int64_t highPriorityRetryCount_{0};
+  int64_t highPriorityDeadlineMissCount_{0};
+  vector<uint8_t> resource_;
+  double publishTime_{0};
+  size_t peakRetainedBytes_{0};
+  uint64_t checksum_{0};
+
+  // Handoffs are only recorded around plain lock/unlock pairs, so in the other
+  // access modes the columns read n/a rather than a misleading zero.
+  static string formatHandoff(const char *label, const LatencyHistogram &histogram) {
+    char buffer[128];
+    if (histogram.count() == 0) {
+      snprintf(buffer, sizeof(buffer), ", %s p50: %10s, p99: %10s", label, "n/a", "n/a");
+    } else {
+      snprintf(buffer, sizeof(buffer), ", %s p50: %10lld, p99: %10lld", label,
+               static_cast<long long>(histogram.percentile(50)),
+               static_cast<long long>(histogram.percentile(99)));
+    }
+    return buffer;
+  }
+
+  static void train(vector<uint8_t> &resource, int64_t step) {
+    memset(resource.data(), static_cast<uint8_t>(step), resource.size());
+  }
+  static uint64_t consume(const vector<uint8_t> &resource) {
+    uint64_t sum = 0;
+    for (uint8_t byte : resource) {
+      sum += byte;
+    }
+    return sum;
+  }
+
+  // Handoff latency is the time from one side starting to unlock to the other
+  // side returning from a lock it was already waiting on when the unlock
+  // started. Only recorded for plain lockLowPriority()/lockHighPriority().
+  void noteRelease(int64_t releaseTime, bool highPriority) {
+    lastReleaseWasHighPriority_.store(highPriority, memory_order_relaxed);
+    lastReleaseTime_.store(releaseTime, memory_order_relaxed);
+  }
+  void noteAcquire(int64_t lockStartTime,
+                   int64_t acquiredTime,
+                   bool highPriority,
+                   LatencyHistogram &handoffHistogram) {
+    const int64_t releaseTime = lastReleaseTime_.load(memory_order_relaxed);
+    if (lastReleaseWasHighPriority_.load(memory_order_relaxed) == highPriority ||
+        releaseTime < lockStartTime) {
+      return;
+    }
+    handoffHistogram.record(BenchmarkClock::elapsed(releaseTime, acquiredTime));
+  }
+
+  // Applies the test's scheduling options to the calling thread. The policy is
+  // set before pinning, so that a thread never sits on the hog's CPU under the
+  // default policy, where the hog could starve it.
+  void applyScheduling(int rank) {
+    if (threadScheduling_ != ThreadScheduling::kDefault) {
+      const int policy = threadScheduling_ == ThreadScheduling::kFifo ? SCHED_FIFO : SCHED_RR;
+      sched_param param{};
+      param.sched_priority = sched_get_priority_min(policy) + 1 + rank;
+      if (pthread_setschedparam(pthread_self(), policy, &param) != 0) {
+        // An unprivileged thread may only lower its own priority, so the
+        // highest rank keeps the default nice value.
+        usedNiceFallback_ = true;
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 5 * (kHighRank - rank));
+      }
+    }
+    if (hasCpuHog_) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu_, &cpus);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+  }
+
+  void lowPriorityThreadFunction() {
+    applyScheduling(kLowRank);
+    const PerfCounters perfCounters;
+    threadsReady_->count_down();
+    int64_t workTime = 0;
+    int64_t step = 0;
+
+    if (publishedResource_ != nullptr) {
+      int64_t publishTime = 0;
+      while (shouldRun_) {
+        // Do work on the private copy...
+        auto startTime = BenchmarkClock::now();
+        this_thread::sleep_for(lowPrioWorkTime_);
+        train(resource_, ++step);
+        auto publishStartTime = BenchmarkClock::now();
+        workTime += BenchmarkClock::elapsed(startTime, publishStartTime);
+
+        publishedResource_->publish(resource_);
+        publishTime += BenchmarkClock::elapsed(publishStartTime, BenchmarkClock::now());
+      }
+      lowPriorityThreadWorkTime_ = workTime;
+      lowPriorityStepCount_ = step;
+      publishTime_ = publishTime;
+      peakRetainedBytes_ = publishedResource_->takePeakRetainedBytes();
+      lowPriorityPerfCounts_ = perfCounters.read();
+      return;
+    }
+
+    // In nanoseconds so that short holds split into many chunks don't round
+    // down to no work at all.
+    const auto chunkTime = chrono::duration_cast<chrono::nanoseconds>(lowPrioWorkTime_) / lowPriorityWorkChunks_;
+    int64_t yieldCount = 0;
+    LatencyHistogram gapHistogram;
+    int64_t unlockTime = 0;
+    LatencyHistogram handoffHistogram;
+    while (shouldRun_) {
+      const auto lockStartTime = BenchmarkClock::now();
+      priorityMutex_->lockLowPriority();
+      
+      // Do work...
+      auto startTime = BenchmarkClock::now();
+      noteAcquire(lockStartTime, startTime, /*highPriority=*/false, handoffHistogram);
+      if (step > 0) {
+        gapHistogram.record(BenchmarkClock::elapsed(unlockTime, startTime));
+      }
+      if (lowPriorityWorkChunks_ == 1) {
+        this_thread::sleep_for(lowPrioWorkTime_);
+      } else {
+        for (int chunk = 0; chunk < lowPriorityWorkChunks_; ++chunk) {
+          if (chunk > 0 && priorityMutex_->shouldYield()) {
+            workTime += BenchmarkClock::elapsed(startTime, BenchmarkClock::now());
+            priorityMutex_->yieldToHighPriority();
+            ++yieldCount;
+            startTime = BenchmarkClock::now();
+          }
+          this_thread::sleep_for(chunkTime);
+        }
+      }
+      priorityMutex_->beginLowPriorityWrite();
+      train(resource_, ++step);
+      priorityMutex_->endLowPriorityWrite();
+      unlockTime = BenchmarkClock::now();
+      workTime += BenchmarkClock::elapsed(startTime, unlockTime);
+      
+      noteRelease(unlockTime, /*highPriority=*/false);
+      priorityMutex_->unlockLowPriority();
+    }
+    priorityMutex_->endLowPriorityLease();
+    lowPriorityThreadWorkTime_ = workTime;
+    lowPriorityStepCount_ = step;
+    lowPriorityGapHistogram_ = gapHistogram;
+    highToLowHandoffHistogram_ = handoffHistogram;
+    lowPriorityYieldCount_ = yieldCount;
+    lowPriorityPerfCounts_ = perfCounters.read();
+  }
+
+  void highPriorityThreadFunction() {
+    applyScheduling(kHighRank);
+    const PerfCounters perfCounters;
+    threadsReady_->count_down();
+    int64_t latencyTime = 0;
+    int64_t accessCount = 0;
+    int64_t retryCount = 0;
+    int64_t deadlineMissCount = 0;
+    uint64_t checksum = 0;
+    LatencyHistogram latencyHistogram;
+    LatencyHistogram handoffHistogram;
+    auto recordLatency = [&](int64_t latency) {
+      latencyTime += latency;
+      latencyHistogram.record(latency);
+    };
+    while (shouldRun_) {
+      // Sleep for a bit.
+      this_thread::sleep_for(highPrioSleepTime_);
+      ++accessCount;
+
+      if (publishedResource_ != nullptr) {
+        auto startTime = BenchmarkClock::now();
+        publishedResource_->read([&](const vector<uint8_t> &resource) {
+          recordLatency(BenchmarkClock::elapsed(startTime, BenchmarkClock::now()));
+          // Do work...
+          this_thread::sleep_for(highPrioWorkTime_);
+          checksum += consume(resource);
+        });
+        continue;
+      }
+
+      if (highPriorityAccess_ == HighPriorityAccess::kOptimisticRead) {
+        auto startTime = BenchmarkClock::now();
+        retryCount += priorityMutex_->readHighPriority([&]() {
+          // Do work...
+          this_thread::sleep_for(highPrioWorkTime_);
+          checksum += consume(resource_);
+        });
+        recordLatency(BenchmarkClock::elapsed(startTime, BenchmarkClock::now()));
+        continue;
+      }
+
+      if (highPriorityAccess_ == HighPriorityAccess::kDelegate) {
+        auto startTime = BenchmarkClock::now();
+        priorityMutex_->delegateHighPriority([&]() {
+          // Do work...
+          this_thread::sleep_for(highPrioWorkTime_);
+          checksum += consume(resource_);
+        });
+        recordLatency(BenchmarkClock::elapsed(startTime, BenchmarkClock::now()));
+        continue;
+      }
+
+      if (!highPriorityDeadlines_.empty()) {
+        // Deadlines are steady_clock time points; latency still uses the
+        // benchmark clock so it compares with the other access modes.
+        const auto startTime = BenchmarkClock::now();
+        const auto deadline = chrono::steady_clock::now() + highPriorityDeadlines_[accessCount % highPriorityDeadlines_.size()];
+        priorityMutex_->lockWithDeadline(deadline);
+        recordLatency(BenchmarkClock::elapsed(startTime, BenchmarkClock::now()));
+        if (chrono::steady_clock::now() > deadline) {
+          ++deadlineMissCount;
+        }
+
+        // Do work...
+        this_thread::sleep_for(highPrioWorkTime_);
+        checksum += consume(resource_);
+
+        priorityMutex_->unlockWithDeadline();
+        continue;
+      }
+
+      auto startTime = BenchmarkClock::now();
+      priorityMutex_->lockHighPriority();
+      const auto acquiredTime = BenchmarkClock::now();
+      recordLatency(BenchmarkClock::elapsed(startTime, acquiredTime));
+      noteAcquire(startTime, acquiredTime, /*highPriority=*/true, handoffHistogram);
+      
+      // Do work...
+      this_thread::sleep_for(highPrioWorkTime_);
+      checksum += consume(resource_);
+
+      noteRelease(BenchmarkClock::now(), /*highPriority=*/true);
+      priorityMutex_->unlockHighPriority();
+    }
+    const PerfCounters::Counts perfCounts = perfCounters.read();
+    lock_guard<mutex> lock(workMutex_);
+    highPriorityPerfCounts_.merge(perfCounts);
+    highPriorityThreadLatencyTime_ += latencyTime;
+    highPriorityLatencyHistogram_.merge(latencyHistogram);
+    lowToHighHandoffHistogram_.merge(handoffHistogram);
+    highPriorityAccessCount_ += accessCount;
+    highPriorityRetryCount_ += retryCount;
+    highPriorityDeadlineMissCount_ += deadlineMissCount;
+    checksum_ += checksum;
+  }
+
+  void checkpointThreadFunction() {
+    applyScheduling(kMiddleRank);
+    threadsReady_->count_down();
+    const int priority = priorityMutex_->priorityLevels() > 2 ? 1 : 0;
+    int64_t latencyTime = 0;
+    uint64_t checksum = 0;
+    while (shouldRun_) {
+      // Sleep for a bit.
+      this_thread::sleep_for(checkpointSleepTime_);
+
+      auto startTime = BenchmarkClock::now();
+      priorityMutex_->lock(priority);
+      latencyTime += BenchmarkClock::elapsed(startTime, BenchmarkClock::now());
+
+      // Do work...
+      this_thread::sleep_for(checkpointWorkTime_);
+      checksum += consume(resource_);
+
+      priorityMutex_->unlock(priority);
+    }
+    checkpointLatencyTime_ = latencyTime;
+    lock_guard<mutex> lock(workMutex_);
+    checksum_ += checksum;
+  }
+
+  void cpuHogThreadFunction() {
+    applyScheduling(kMiddleRank);
+    while (shouldRun_) {
+      cpuRelax();
+    }
+  }
+};
+
+// `configure`, if set, is applied to every ContentionTest before it runs.
+// `publishedResources` are swept alongside `priorityMutexes` and compete for
+// the same win counts.
+void runSweep(const vector<pair<PriorityMutex*, string>> &priorityMutexes,
+              const vector<chrono::microseconds> &microseconds,
+              const function<void(ContentionTest&)> &configure = {},
+              const vector<pair<PublishedResource*, string>> &publishedResources = {}) {
+  printf("  Low Work,  High Work, High Sleep\n");
+  map<string, int> winnerCountForLow;
+  map<string, int> winnerCountForHigh;
+  for (auto lowPrioWorkTime : microseconds) {
+    for (auto highPrioWorkTime : microseconds) {
+      for (auto highPrioSleepTime : microseconds) {
+        string bestLowName;
+        string bestHighName;
+        string bestBothName;
+        double bestLow = 0.0;
+        double bestHigh = numeric_limits<double>::max();
+        printf("%10d, %10d, %10d\n", lowPrioWorkTime.count(), highPrioWorkTime.count(), highPrioSleepTime.count());
+        auto runTest = [&](ContentionTest &test, const string &name) {
+          if (configure) {
+            configure(test);
+          }
+          const auto [lowPriorityWorkTime, highPriorityLatencyTime] = test.run();
+          printf("%31s Low Priority: %12.0f, High Priority: %12.0f%s\n", name.data(), lowPriorityWorkTime, highPriorityLatencyTime, test.details().data());
+          if (lowPriorityWorkTime > bestLow) {
+            bestLow = lowPriorityWorkTime;
+            bestLowName = name;
+          }
+          if (highPriorityLatencyTime < bestHigh) {
+            bestHigh = highPriorityLatencyTime;
+            bestHighName = name;
+          }
+        };
+        for (auto &priorityMutexAndName : priorityMutexes) {
+          ContentionTest test(priorityMutexAndName.first, lowPrioWorkTime, highPrioWorkTime, highPrioSleepTime);
+          runTest(test, priorityMutexAndName.second);
+        }
+        for (auto &publishedResourceAndName : publishedResources) {
+          ContentionTest test(publishedResourceAndName.first, lowPrioWorkTime, highPrioWorkTime, highPrioSleepTime);
+          runTest(test, publishedResourceAndName.second);
+        }
+        winnerCountForLow[bestLowName] += 1;
+        winnerCountForHigh[bestHighName] += 1;
+      }
+    }
+  }
+  cout << "Algorithm win counts for Low Priority Thread amount of work:" << endl;
+  for (const auto &i : winnerCountForLow) {
+    cout << "  " << i.first << ": " << i.second << endl;
+  }
+  cout << "Algorithm win counts for High Priority Thread lowest latency:" << endl;
+  for (const auto &i : winnerCountForHigh) {
+    cout << "  " << i.first << ": " << i.second << endl;
+  }
+}
+
+// Sweeps the spin budgets of SpinThenParkPriorityMutex over the short hold
+// times, where parking costs as much as the hold itself.
+void runSpinBudgetSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes;
+  const vector<chrono::microseconds> highPrioritySpinBudgets = {
+    chrono::microseconds{0},
+    chrono::microseconds{1},
+    chrono::microseconds{10},
+    chrono::microseconds{100},
+    chrono::microseconds{1'000}
+  };
+  const vector<chrono::microseconds> lowPrioritySpinBudgets = {
+    chrono::microseconds{0},
+    chrono::microseconds{1}
+  };
+  for (auto highPrioritySpinBudget : highPrioritySpinBudgets) {
+    for (auto lowPrioritySpinBudget : lowPrioritySpinBudgets) {
+      priorityMutexes.emplace_back(new SpinThenParkPriorityMutex(highPrioritySpinBudget, lowPrioritySpinBudget),
+                                   "SpinThenPark(" + to_string(highPrioritySpinBudget.count()) + "us," + to_string(lowPrioritySpinBudget.count()) + "us)");
+    }
+  }
+  runSweep(priorityMutexes, {
+    chrono::microseconds{1},
+    chrono::microseconds{10},
+    chrono::microseconds{100},
+    chrono::microseconds{1'000}
+  });
+}
+
+// Drives the high priority side through readHighPriority(). Implementations
+// without an optimistic path fall back to holding the lock for the read.
+void runOptimisticReadSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new SeqlockPriorityMutex(), "SeqlockPriorityMutex"}
+  };
+  runSweep(priorityMutexes, {
+    chrono::microseconds{1},
+    chrono::microseconds{10},
+    chrono::microseconds{100},
+    chrono::microseconds{1'000},
+    chrono::microseconds{10'000},
+    chrono::microseconds{100'000},
+    chrono::microseconds{1'000'000}
+  }, [](ContentionTest &test) {
+    test.setHighPriorityAccess(ContentionTest::HighPriorityAccess::kOptimisticRead);
+  });
+}
+
+// Compares the best lock-based implementations against publishing a private
+// copy, for several sizes of the shared resource. Published resources also
+// report how much memory their copies held at peak.
+void runPublishSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"}
+  };
+  vector<std::pair<PublishedResource*, std::string>> publishedResources = {
+    {new DoubleBufferedResource(), "DoubleBufferedResource"},
+    {new RcuResource(), "RcuResource"}
+  };
+  const vector<size_t> resourceSizes = {
+    1 << 10,
+    1 << 20,
+    64 << 20
+  };
+  for (size_t resourceSize : resourceSizes) {
+    printf("Resource Size: %zu bytes\n", resourceSize);
+    runSweep(priorityMutexes, {
+      chrono::microseconds{1},
+      chrono::microseconds{10},
+      chrono::microseconds{100},
+      chrono::microseconds{1'000},
+      chrono::microseconds{10'000},
+      chrono::microseconds{100'000},
+      chrono::microseconds{1'000'000}
+    }, [resourceSize](ContentionTest &test) {
+      test.setResourceSize(resourceSize);
+    }, publishedResources);
+  }
+}
+
+// Runs several high priority threads at once to show how each implementation
+// scales as high priority accessors are added. MutexAndAtomicBoolPriorityMutex
+// and MutexAndTwoBoolPriorityMutex are left out: each side shares a single
+// unique_lock, so they only support one thread per side.
+void runReaderScalingSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new ReaderWriterPriorityMutex(), "ReaderWriterPriorityMutex"}
+  };
+  const vector<int> highPriorityThreadCounts = {1, 2, 4, 8};
+  for (int highPriorityThreadCount : highPriorityThreadCounts) {
+    printf("High Priority Threads: %d\n", highPriorityThreadCount);
+    runSweep(priorityMutexes, {
+      chrono::microseconds{10},
+      chrono::microseconds{100},
+      chrono::microseconds{1'000},
+      chrono::microseconds{10'000}
+    }, [highPriorityThreadCount](ContentionTest &test) {
+      test.setHighPriorityThreadCount(highPriorityThreadCount);
+    });
+  }
+}
+
+// Adds a checkpoint thread as a third class of accessor. Only implementations
+// that tolerate more than one thread per side are swept, since the checkpoint
+// thread shares the low priority side of the two-level implementations.
+void runThreeLevelSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new TwoMutexPriorityMutex(), "TwoMutexPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new McsPriorityMutex(), "McsPriorityMutex"},
+    {new TicketPriorityMutex(), "TicketPriorityMutex"},
+    {new LeveledPriorityMutex(3), "LeveledPriorityMutex"}
+  };
+  const vector<pair<chrono::microseconds, chrono::microseconds>> checkpointWorkAndSleepTimes = {
+    {chrono::microseconds{1'000}, chrono::microseconds{100'000}},
+    {chrono::microseconds{100'000}, chrono::microseconds{1'000'000}}
+  };
+  for (auto [checkpointWorkTime, checkpointSleepTime] : checkpointWorkAndSleepTimes) {
+    printf("Checkpoint Work: %lld, Checkpoint Sleep: %lld\n", static_cast<long long>(checkpointWorkTime.count()), static_cast<long long>(checkpointSleepTime.count()));
+    runSweep(priorityMutexes, {
+      chrono::microseconds{10},
+      chrono::microseconds{100},
+      chrono::microseconds{1'000},
+      chrono::microseconds{10'000}
+    }, [checkpointWorkTime = checkpointWorkTime, checkpointSleepTime = checkpointSleepTime](ContentionTest &test) {
+      test.setCheckpoint(checkpointWorkTime, checkpointSleepTime);
+    });
+  }
+}
+
+// Drives the high priority side through delegateHighPriority(), comparing
+// delegation against implementations that run the request on the caller.
+void runDelegationSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new DelegatingPriorityMutex(), "DelegatingPriorityMutex"}
+  };
+  // With chunked holds the holder reaches a safe point between every chunk,
+  // rather than only at unlock.
+  const vector<int> lowPriorityWorkChunks = {1, 10};
+  for (int chunks : lowPriorityWorkChunks) {
+    printf("Low Priority Work Chunks: %d\n", chunks);
+    runSweep(priorityMutexes, {
+      chrono::microseconds{1},
+      chrono::microseconds{10},
+      chrono::microseconds{100},
+      chrono::microseconds{1'000},
+      chrono::microseconds{10'000},
+      chrono::microseconds{100'000},
+      chrono::microseconds{1'000'000}
+    }, [chunks](ContentionTest &test) {
+      test.setHighPriorityAccess(ContentionTest::HighPriorityAccess::kDelegate);
+      test.setLowPriorityWorkChunks(chunks);
+    });
+  }
+}
+
+// Splits every low priority hold into chunks with a yield checkpoint between
+// each, trading low priority throughput for high priority latency.
+void runWorkChunkSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new FutexPriorityMutex(/*directHandoff=*/true), "FutexHandoffPriorityMutex"},
+    {new TicketPriorityMutex(), "TicketPriorityMutex"}
+  };
+  const vector<int> lowPriorityWorkChunks = {1, 10, 100};
+  for (int chunks : lowPriorityWorkChunks) {
+    printf("Low Priority Work Chunks: %d\n", chunks);
+    runSweep(priorityMutexes, {
+      chrono::microseconds{10},
+      chrono::microseconds{1'000},
+      chrono::microseconds{100'000},
+      chrono::microseconds{1'000'000}
+    }, [chunks](ContentionTest &test) {
+      test.setLowPriorityWorkChunks(chunks);
+    });
+  }
+}
+
+// Lets the kernel scheduler enforce priority, with and without a CPU hog
+// competing with the low priority holder.
+void runSchedulingSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new PthreadInheritPriorityMutex(), "PthreadInheritPriorityMutex"}
+  };
+  const vector<pair<ContentionTest::ThreadScheduling, string>> threadSchedulings = {
+    {ContentionTest::ThreadScheduling::kDefault, "SCHED_OTHER"},
+    {ContentionTest::ThreadScheduling::kFifo, "SCHED_FIFO"},
+    {ContentionTest::ThreadScheduling::kRoundRobin, "SCHED_RR"}
+  };
+  for (const auto &[threadScheduling, schedulingName] : threadSchedulings) {
+    for (bool cpuHog : {false, true}) {
+      printf("Scheduling: %s, CPU Hog: %s\n", schedulingName.data(), cpuHog ? "yes" : "no");
+      runSweep(priorityMutexes, {
+        chrono::microseconds{10},
+        chrono::microseconds{1'000},
+        chrono::microseconds{100'000}
+      }, [threadScheduling = threadScheduling, cpuHog](ContentionTest &test) {
+        test.setThreadScheduling(threadScheduling);
+        test.setCpuHog(cpuHog);
+      });
+    }
+  }
+}
+
+// Compares leases of several lengths against acquiring on every hold, over the
+// short holds where the cost of acquiring matters.
+void runLeaseSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new BiasedPriorityMutex(), "BiasedPriorityMutex"}
+  };
+  const vector<pair<chrono::microseconds, int>> leases = {
+    {chrono::microseconds{100}, 10},
+    {chrono::microseconds{1'000}, 100},
+    {chrono::microseconds{10'000}, 1'000}
+  };
+  for (auto [leaseDuration, leaseIterations] : leases) {
+    priorityMutexes.emplace_back(new LeasePriorityMutex(leaseDuration, leaseIterations),
+                                 "Lease(" + to_string(leaseDuration.count()) + "us," + to_string(leaseIterations) + ")");
+  }
+  runSweep(priorityMutexes, {
+    chrono::microseconds{1},
+    chrono::microseconds{10},
+    chrono::microseconds{100},
+    chrono::microseconds{1'000}
+  });
+}
+
+// Reserves windows of a tenth of each period for the high priority thread. A
+// period only lines up with the high priority thread where it matches the
+// high priority sleep time.
+void runTdmaSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"}
+  };
+  const vector<chrono::microseconds> windowPeriods = {
+    chrono::microseconds{1'000},
+    chrono::microseconds{10'000},
+    chrono::microseconds{100'000}
+  };
+  for (auto windowPeriod : windowPeriods) {
+    priorityMutexes.emplace_back(new TdmaPriorityMutex(windowPeriod, windowPeriod / 10),
+                                 "Tdma(" + to_string(windowPeriod.count()) + "us)");
+  }
+  runSweep(priorityMutexes, {
+    chrono::microseconds{10},
+    chrono::microseconds{1'000},
+    chrono::microseconds{10'000},
+    chrono::microseconds{100'000}
+  });
+}
+
+// Several high priority threads acquire with a mix of tight and loose
+// deadlines, so the order in which waiters are served matters.
+void runDeadlineSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new McsPriorityMutex(), "McsPriorityMutex"},
+    {new EdfPriorityMutex(), "EdfPriorityMutex"}
+  };
+  runSweep(priorityMutexes, {
+    chrono::microseconds{10},
+    chrono::microseconds{100},
+    chrono::microseconds{1'000},
+    chrono::microseconds{10'000}
+  }, [](ContentionTest &test) {
+    test.setHighPriorityThreadCount(4);
+    test.setHighPriorityDeadlines({chrono::microseconds{200}, chrono::microseconds{5'000}});
+  });
+}
+
+// Caps the low priority thread's duty cycle at several rates, trading its
+// throughput for high priority latency.
+void runRateLimitSweep() {
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"}
+  };
+  const vector<double> dutyCycles = {0.25, 0.5, 0.75, 0.9};
+  for (double dutyCycle : dutyCycles) {
+    char name[64];
+    snprintf(name, sizeof(name), "RateLimited(Basic,%.2f)", dutyCycle);
+    priorityMutexes.emplace_back(new RateLimitedPriorityMutex(new BasicPriorityMutex(), dutyCycle), name);
+  }
+  runSweep(priorityMutexes, {
+    chrono::microseconds{10},
+    chrono::microseconds{1'000},
+    chrono::microseconds{100'000},
+    chrono::microseconds{1'000'000}
+  });
+}
+
+int main(int argc, char **argv) {
+  BenchmarkClock::calibrate();
+  // Sweeps other than the default one, selected by the first argument.
+  const map<string_view, void (*)()> sweeps = {
+    {"spin", runSpinBudgetSweep},
+    {"read", runOptimisticReadSweep},
+    {"publish", runPublishSweep},
+    {"readers", runReaderScalingSweep},
+    {"levels", runThreeLevelSweep},
+    {"delegate", runDelegationSweep},
+    {"chunks", runWorkChunkSweep},
+    {"sched", runSchedulingSweep},
+    {"lease", runLeaseSweep},
+    {"tdma", runTdmaSweep},
+    {"deadline", runDeadlineSweep},
+    {"rate", runRateLimitSweep}
+  };
+  if (argc > 1) {
+    const auto sweep = sweeps.find(argv[1]);
+    if (sweep != sweeps.end()) {
+      sweep->second();
+      return 0;
+    }
+  }
+  vector<std::pair<PriorityMutex*, std::string>> priorityMutexes = {
+    {new BasicPriorityMutex(), "BasicPriorityMutex"},
+    {new TwoMutexPriorityMutex(), "TwoMutexPriorityMutex"},
+    {new MutexAndAtomicBoolPriorityMutex(), "MutexAndAtomicBoolPriorityMutex"},
+    {new MutexAndTwoBoolPriorityMutex(), "MutexAndTwoBoolPriorityMutex"},
+    {new AtomicWaitPriorityMutex(), "AtomicWaitPriorityMutex"},
+    {new FutexPriorityMutex(), "FutexPriorityMutex"},
+    {new FutexPriorityMutex(/*directHandoff=*/true), "FutexHandoffPriorityMutex"},
+    {new PredictivePriorityMutex(), "PredictivePriorityMutex"},
+    {new SeqlockPriorityMutex(), "SeqlockPriorityMutex"},
+    {new McsPriorityMutex(), "McsPriorityMutex"},
+    {new TicketPriorityMutex(), "TicketPriorityMutex"},
+    {new ReaderWriterPriorityMutex(), "ReaderWriterPriorityMutex"},
+    {new LeveledPriorityMutex(2), "LeveledPriorityMutex"},
+    {new BiasedPriorityMutex(), "BiasedPriorityMutex"}
+  };
+  vector<chrono::microseconds> microseconds = {
+    chrono::microseconds{1},
+    chrono::microseconds{10},
+    chrono::microseconds{100},
+    chrono::microseconds{1'000},
+    chrono::microseconds{10'000},
+    chrono::microseconds{100'000},
+    chrono::microseconds{1'000'000}
+  };
+  runSweep(priorityMutexes, microseconds);
   return 0;
-}
\ No newline at end of file
+}